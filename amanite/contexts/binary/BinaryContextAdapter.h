@@ -0,0 +1,229 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <cstdio>
+#include <cassert>
+#include <iterator>
+
+#include <boost/utility/string_ref.hpp>
+
+#include "BinaryDocument.h"
+
+
+namespace amanite {
+	namespace template_engine {
+		namespace context {
+
+			/**
+			* Context adapter reading a BinaryDocument in place.
+			*
+			* Unlike the JSON adapters, children are returned by value and built on the fly, so reading a context
+			* allocates nothing. A child refers to the adapter it has been read from, which must outlive it : the
+			* Renderer keeps the adapters of the enclosing sections alive. The tools keeping pointers to contexts
+			* between accesses (PartialEvaluator, IncrementalRenderer) need adapters returning references.
+			* The document must outlive the adapter.
+			*/
+			class BinaryContextAdapter {
+			public:
+				class Items;
+
+				BinaryContextAdapter(const BinaryDocument& document) : m_document(&document), m_pos(document.getRoot()) { }
+
+				BinaryContextAdapter(const BinaryDocument& document, std::size_t pos, const BinaryContextAdapter& parent)
+						: m_document(&document), m_pos(pos), m_parent(&parent) { }
+
+				BinaryContextAdapter operator[](const std::string& key) const {
+					return get(key);
+				}
+
+				BinaryContextAdapter get(const std::string& key) const {
+					std::size_t pos = isObject() ? m_document->findMember(m_pos, key) : BinaryDocument::npos;
+					return BinaryContextAdapter(*m_document, pos, *this);
+				}
+
+				bool has(const std::string& key) const {
+					return isObject() && m_document->findMember(m_pos, key) != BinaryDocument::npos;
+				}
+
+				/**
+				* Identity of the value : its position in the document.
+				*/
+				std::shared_ptr<const void> getIdentity() const {
+					if(m_pos == BinaryDocument::npos)
+						return nullptr;
+					return std::shared_ptr<const void>(m_document->shared_from_this(), m_document->getData() + m_pos);
+				}
+
+				bool hasParent() const {
+					return m_parent != nullptr;
+				}
+
+				const BinaryContextAdapter& getParentContext() const {
+					assert(m_parent != nullptr);
+					return *m_parent;
+				}
+
+				bool isArray() const {
+					return is(BinaryDocument::ARRAY);
+				}
+
+				bool isObject() const {
+					return is(BinaryDocument::OBJECT);
+				}
+
+				/**
+				* The items have this adapter as parent, like the items of a JsonContextAdapter.
+				*/
+				Items getAsArray() const;
+
+				std::size_t getArraySize() const {
+					return isArray() ? m_document->getCount(m_pos) : 0;
+				}
+
+				bool isString() const {
+					return is(BinaryDocument::STRING);
+				}
+
+				/**
+				* Same text as JsonContextAdapter::getAsString, except for arrays and objects which give an empty string.
+				*/
+				boost::string_ref getAsString() const {
+					if(m_pos == BinaryDocument::npos)
+						return "null";
+					switch(m_document->getType(m_pos)) {
+						case BinaryDocument::STRING:
+							return m_document->getString(m_pos);
+						case BinaryDocument::NUMBER:
+							return formatNumber();
+						case BinaryDocument::BOOLEAN_TRUE:
+							return "true";
+						case BinaryDocument::BOOLEAN_FALSE:
+							return "false";
+						case BinaryDocument::NUL:
+							return "null";
+						default:
+							return boost::string_ref();
+					}
+				}
+
+				bool isDouble() const {
+					return is(BinaryDocument::NUMBER);
+				}
+
+				double getAsDouble() const {
+					return isDouble() ? m_document->getNumber(m_pos) : 0;
+				}
+
+				bool isBoolean() const {
+					return is(BinaryDocument::BOOLEAN_TRUE) || is(BinaryDocument::BOOLEAN_FALSE);
+				}
+
+				bool getAsBoolean() const {
+					return is(BinaryDocument::BOOLEAN_TRUE);
+				}
+
+				bool isNull() const {
+					return m_pos == BinaryDocument::npos || is(BinaryDocument::NUL);
+				}
+
+			private:
+				bool is(BinaryDocument::Type type) const {
+					return m_pos != BinaryDocument::npos && m_document->getType(m_pos) == type;
+				}
+
+				/**
+				* Numbers are written as std::to_string does, in a buffer of the adapter. Only numbers too large
+				* for the buffer are written in an allocated string.
+				*/
+				boost::string_ref formatNumber() const {
+					double value = m_document->getNumber(m_pos);
+					int length = std::snprintf(m_number, sizeof(m_number), "%f", value);
+					if(length >= 0 && static_cast<std::size_t>(length) < sizeof(m_number))
+						return boost::string_ref(m_number, length);
+					m_largeNumber = std::to_string(value);
+					return m_largeNumber;
+				}
+
+				const BinaryDocument* m_document = nullptr;
+				std::size_t m_pos = BinaryDocument::npos;
+				const BinaryContextAdapter* m_parent = nullptr;
+				mutable char m_number[32];
+				mutable std::string m_largeNumber;
+			};
+
+			/**
+			* Items of an array, built when the range is iterated.
+			*/
+			class BinaryContextAdapter::Items {
+			public:
+				class iterator {
+				public:
+					typedef std::input_iterator_tag iterator_category;
+					typedef BinaryContextAdapter value_type;
+					typedef std::ptrdiff_t difference_type;
+					typedef void pointer;
+					typedef BinaryContextAdapter reference;
+
+					iterator(const BinaryContextAdapter& array, std::size_t index) : m_array(&array), m_index(index) { }
+
+					BinaryContextAdapter operator*() const {
+						const BinaryDocument& document = *m_array->m_document;
+						return BinaryContextAdapter(document, document.getItem(m_array->m_pos, m_index), *m_array);
+					}
+
+					iterator& operator++() {
+						++m_index;
+						return *this;
+					}
+
+					iterator operator++(int) {
+						iterator res = *this;
+						++m_index;
+						return res;
+					}
+
+					bool operator==(const iterator& other) const {
+						return m_index == other.m_index;
+					}
+
+					bool operator!=(const iterator& other) const {
+						return m_index != other.m_index;
+					}
+
+				private:
+					const BinaryContextAdapter* m_array;
+					std::size_t m_index;
+				};
+
+				typedef iterator const_iterator;
+
+				Items(const BinaryContextAdapter& array, std::size_t size) : m_array(&array), m_size(size) { }
+
+				iterator begin() const {
+					return iterator(*m_array, 0);
+				}
+
+				iterator end() const {
+					return iterator(*m_array, m_size);
+				}
+
+				std::size_t size() const {
+					return m_size;
+				}
+
+				bool empty() const {
+					return m_size == 0;
+				}
+
+			private:
+				const BinaryContextAdapter* m_array;
+				std::size_t m_size;
+			};
+
+			inline BinaryContextAdapter::Items BinaryContextAdapter::getAsArray() const {
+				return Items(*this, isArray() ? m_document->getCount(m_pos) : 0);
+			}
+		}
+	}
+}
@@ -0,0 +1,113 @@
+#include "BinaryConverter.h"
+#include "BinaryDocument.h"
+
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+
+namespace amanite {
+	namespace template_engine {
+		namespace context {
+
+			namespace {
+				class BinaryWriter {
+				public:
+					explicit BinaryWriter(std::string& out) : m_out(out) {
+					}
+
+					void write(const json11::Json& json) {
+						switch(json.type()) {
+							case json11::Json::NUL:
+								writeType(BinaryDocument::NUL);
+								break;
+							case json11::Json::BOOL:
+								writeType(json.bool_value() ? BinaryDocument::BOOLEAN_TRUE : BinaryDocument::BOOLEAN_FALSE);
+								break;
+							case json11::Json::NUMBER:
+								writeType(BinaryDocument::NUMBER);
+								writeNumber(json.number_value());
+								break;
+							case json11::Json::STRING:
+								writeType(BinaryDocument::STRING);
+								writeSize(json.string_value().size());
+								m_out += json.string_value();
+								break;
+							case json11::Json::ARRAY:
+								writeArray(json.array_items());
+								break;
+							case json11::Json::OBJECT:
+								writeObject(json.object_items());
+								break;
+						}
+					}
+
+				private:
+					void writeArray(const json11::Json::array& items) {
+						writeType(BinaryDocument::ARRAY);
+						writeSize(items.size());
+						std::size_t positions = reserve(4 * items.size());
+						for(const json11::Json& item : items) {
+							patchSize(positions, m_out.size());
+							positions += 4;
+							write(item);
+						}
+					}
+
+					/**
+					* The members of a json11 object are sorted by key, as required by the format.
+					*/
+					void writeObject(const json11::Json::object& members) {
+						writeType(BinaryDocument::OBJECT);
+						writeSize(members.size());
+						std::size_t entries = reserve(12 * members.size());
+						for(const auto& member : members) {
+							patchSize(entries, m_out.size());
+							patchSize(entries + 4, member.first.size());
+							m_out += member.first;
+							patchSize(entries + 8, m_out.size());
+							write(member.second);
+							entries += 12;
+						}
+					}
+
+					void writeType(BinaryDocument::Type type) {
+						m_out += static_cast<char>(type);
+					}
+
+					void writeNumber(double value) {
+						std::uint64_t bits;
+						std::memcpy(&bits, &value, sizeof(bits));
+						for(int i = 0; i < 8; ++i)
+							m_out += static_cast<char>((bits >> (8 * i)) & 0xFF);
+					}
+
+					void writeSize(std::size_t value) {
+						patchSize(reserve(4), value);
+					}
+
+					std::size_t reserve(std::size_t length) {
+						std::size_t res = m_out.size();
+						m_out.append(length, '\0');
+						return res;
+					}
+
+					void patchSize(std::size_t pos, std::size_t value) {
+						if(value > 0xFFFFFFFFu)
+							throw std::length_error("The binary context exceeds 4GB");
+						for(int i = 0; i < 4; ++i)
+							m_out[pos + i] = static_cast<char>((value >> (8 * i)) & 0xFF);
+					}
+
+					std::string& m_out;
+				};
+			}
+
+			std::string convertToBinary(const json11::Json& json) {
+				std::string res("AMBC");
+				res += static_cast<char>(BinaryDocument::version);
+				BinaryWriter(res).write(json);
+				return res;
+			}
+		}
+	}
+}
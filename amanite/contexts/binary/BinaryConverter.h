@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+
+#include "amanite/contexts/json/json11.hpp"
+
+namespace amanite {
+	namespace template_engine {
+		namespace context {
+
+			/**
+			* Encode json in the format read by BinaryDocument.
+			* Throw a std::length_error if the result does not fit the 32 bits positions of the format.
+			*/
+			std::string convertToBinary(const json11::Json& json);
+		}
+	}
+}
@@ -0,0 +1,91 @@
+#include "BinaryDocument.h"
+
+#include <stdexcept>
+#include <cstring>
+
+namespace amanite {
+	namespace template_engine {
+		namespace context {
+
+			const std::size_t BinaryDocument::npos;
+			const std::uint8_t BinaryDocument::version;
+			const std::size_t BinaryDocument::headerSize;
+
+			std::shared_ptr<BinaryDocument> BinaryDocument::fromBuffer(const char* data, std::size_t size) {
+				std::shared_ptr<BinaryDocument> res(new BinaryDocument(data, size));
+				res->checkHeader();
+				return res;
+			}
+
+			std::shared_ptr<BinaryDocument> BinaryDocument::fromString(std::string data) {
+				std::shared_ptr<BinaryDocument> res(new BinaryDocument(nullptr, 0));
+				res->m_string = std::move(data);
+				res->m_data = res->m_string.data();
+				res->m_size = res->m_string.size();
+				res->checkHeader();
+				return res;
+			}
+
+			std::shared_ptr<BinaryDocument> BinaryDocument::fromFile(const std::string& fileName) {
+				std::shared_ptr<BinaryDocument> res(new BinaryDocument(nullptr, 0));
+				res->m_file.open(fileName);
+				if(!res->m_file.is_open())
+					throw std::invalid_argument("The file " + fileName + " can not be mapped.");
+				res->m_data = res->m_file.data();
+				res->m_size = res->m_file.size();
+				res->checkHeader();
+				return res;
+			}
+
+			BinaryDocument::BinaryDocument(const char* data, std::size_t size) : m_data(data), m_size(size) {
+			}
+
+			void BinaryDocument::checkHeader() const {
+				if(m_size <= headerSize || std::memcmp(m_data, "AMBC", 4) != 0)
+					throw std::runtime_error("Not a binary context");
+				if(static_cast<std::uint8_t>(m_data[4]) != version)
+					throw std::runtime_error("Unsupported binary context version " + std::to_string(static_cast<std::uint8_t>(m_data[4])));
+			}
+
+			/**
+			* Positions come from the data, so they are checked before being read.
+			*/
+			void BinaryDocument::check(std::size_t pos, std::size_t length) const {
+				if(pos > m_size || length > m_size - pos)
+					throw std::runtime_error("Corrupted binary context at position " + std::to_string(pos));
+			}
+
+			double BinaryDocument::getNumber(std::size_t pos) const {
+				check(pos + 1, 8);
+				const unsigned char* bytes = reinterpret_cast<const unsigned char*>(m_data + pos + 1);
+				std::uint64_t bits = 0;
+				for(int i = 7; i >= 0; --i)
+					bits = bits << 8 | bytes[i];
+				double res;
+				std::memcpy(&res, &bits, sizeof(res));
+				return res;
+			}
+
+			std::size_t BinaryDocument::findMember(std::size_t pos, boost::string_ref key) const {
+				std::size_t first = 0;
+				std::size_t last = getCount(pos);
+				std::size_t entries = pos + 5;
+				while(first < last) {
+					std::size_t middle = first + (last - first) / 2;
+					std::size_t entry = entries + 12 * middle;
+					std::uint32_t keyLength = readSize(entry + 4);
+					std::uint32_t keyPos = readSize(entry);
+					check(keyPos, keyLength);
+					int comparison = boost::string_ref(m_data + keyPos, keyLength).compare(key);
+					if(comparison == 0)
+						return readSize(entry + 8);
+					if(comparison < 0)
+						first = middle + 1;
+					else
+						last = middle;
+				}
+				return npos;
+			}
+		}
+	}
+}
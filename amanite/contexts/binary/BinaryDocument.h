@@ -0,0 +1,120 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+#include <boost/utility/string_ref.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+namespace amanite {
+	namespace template_engine {
+		namespace context {
+
+			/**
+			* Context encoded in a binary format which is read in place : loading a document only checks its header.
+			*
+			* All integers are unsigned 32 bits little endian, positions are offsets from the start of the document.
+			*
+			*   document := "AMBC" version:u8 value
+			*   value    := NUL | BOOLEAN_FALSE | BOOLEAN_TRUE
+			*             | NUMBER f64 (IEEE 754, little endian)
+			*             | STRING length:u32 bytes
+			*             | ARRAY count:u32 position:u32[count] value[count]
+			*             | OBJECT count:u32 (keyPosition:u32 keyLength:u32 valuePosition:u32)[count] ...
+			*
+			* Each value starts with its type, on one byte. The entries of an object are sorted by key, comparing
+			* the bytes as unsigned values, so that keys are found by binary search. The keys and the values they
+			* point to follow the entries, in any order.
+			*
+			* The data is either a memory-mapped file or a string owned by the document, or a buffer owned by the caller.
+			*/
+			class BinaryDocument : public std::enable_shared_from_this<BinaryDocument> {
+			public:
+				static const std::size_t npos = static_cast<std::size_t>(-1);
+				static const std::uint8_t version = 1;
+
+				enum Type {
+					NUL = 0, BOOLEAN_FALSE = 1, BOOLEAN_TRUE = 2, NUMBER = 3, STRING = 4, ARRAY = 5, OBJECT = 6
+				};
+
+				/**
+				* Read a buffer. The buffer must outlive the document.
+				*/
+				static std::shared_ptr<BinaryDocument> fromBuffer(const char* data, std::size_t size);
+
+				static std::shared_ptr<BinaryDocument> fromString(std::string data);
+
+				/**
+				* Map a file in memory.
+				*/
+				static std::shared_ptr<BinaryDocument> fromFile(const std::string& fileName);
+
+				/**
+				* Position of the root value.
+				*/
+				std::size_t getRoot() const {
+					return headerSize;
+				}
+
+				const char* getData() const {
+					return m_data;
+				}
+
+				Type getType(std::size_t pos) const {
+					check(pos, 1);
+					return static_cast<Type>(static_cast<std::uint8_t>(m_data[pos]));
+				}
+
+				double getNumber(std::size_t pos) const;
+
+				boost::string_ref getString(std::size_t pos) const {
+					std::uint32_t length = readSize(pos + 1);
+					check(pos + 5, length);
+					return boost::string_ref(m_data + pos + 5, length);
+				}
+
+				/**
+				* Number of items of the array, or of members of the object, at pos.
+				*/
+				std::size_t getCount(std::size_t pos) const {
+					return readSize(pos + 1);
+				}
+
+				/**
+				* Position of the item at index in the array at pos.
+				*/
+				std::size_t getItem(std::size_t pos, std::size_t index) const {
+					return readSize(pos + 5 + 4 * index);
+				}
+
+				/**
+				* Position of the value bound to key in the object at pos, or npos.
+				*/
+				std::size_t findMember(std::size_t pos, boost::string_ref key) const;
+
+			private:
+				static const std::size_t headerSize = 5;
+
+				BinaryDocument(const char* data, std::size_t size);
+
+				void checkHeader() const;
+
+				void check(std::size_t pos, std::size_t length) const;
+
+				std::uint32_t readSize(std::size_t pos) const {
+					check(pos, 4);
+					const unsigned char* bytes = reinterpret_cast<const unsigned char*>(m_data + pos);
+					return static_cast<std::uint32_t>(bytes[0]) | static_cast<std::uint32_t>(bytes[1]) << 8
+							| static_cast<std::uint32_t>(bytes[2]) << 16 | static_cast<std::uint32_t>(bytes[3]) << 24;
+				}
+
+				boost::iostreams::mapped_file_source m_file;
+				std::string m_string;
+				const char* m_data;
+				std::size_t m_size;
+			};
+		}
+	}
+}
@@ -4,6 +4,8 @@
 #include <map>
 #include <list>
 #include <memory>
+#include <iterator>
+#include <cassert>
 
 #include "json11.hpp"
 
@@ -12,28 +14,72 @@ namespace amanite {
 	namespace template_engine {
 		namespace context {
 
+			/**
+			* State shared by the adapters of a JsonContextAdapterPool.
+			*/
+			struct JsonContextAdapterPoolState {
+				//incremented each time the pool is bound to another value : the adapters bound before are stale.
+				std::size_t epoch = 0;
+				std::size_t adapters = 0;
+				//approximate size of the adapters and of their keys, without the allocator overhead.
+				std::size_t bytes = 0;
+			};
+
 			struct JsonContextAdapter {
 				const json11::Json* m_json = nullptr;
 				const JsonContextAdapter* m_parent = nullptr;
 				mutable std::map <std::string, std::unique_ptr<JsonContextAdapter>> m_children;
 				mutable std::list<JsonContextAdapter> m_array_items;
+				//items of the previous, longer arrays, reused by the next ones.
+				mutable std::list<JsonContextAdapter> m_spare_items;
+				//pool of the adapter, null if it is not pooled, and epoch of the pool m_json was bound at.
+				JsonContextAdapterPoolState* m_pool = nullptr;
+				std::size_t m_epoch = 0;
 
 				JsonContextAdapter(const json11::Json& json) : m_json(&json)/*, m_parent(nullptr)*/ { }
 
-				JsonContextAdapter(const json11::Json& json, const JsonContextAdapter& parent) : m_json(&json), m_parent(&parent) { }
+				JsonContextAdapter(const json11::Json& json, const JsonContextAdapter& parent)
+						: m_json(&json), m_parent(&parent), m_pool(parent.m_pool), m_epoch(parent.m_epoch) { }
 
 				const JsonContextAdapter& operator[](const std::string& key) const {
 					return get(key);
 				}
 
 				const JsonContextAdapter& get(const std::string& key) const {
-					auto& item = m_children.find(key);
+					auto item = m_children.find(key);
 					if(item == m_children.end()) {
-						m_children.emplace(key, std::make_unique<JsonContextAdapter>((*m_json)[key], *this));
-						return *(m_children[key].get());
-					} else {
-						return *(item->second.get());
+						item = m_children.emplace(key, std::make_unique<JsonContextAdapter>((*m_json)[key], *this)).first;
+						allocated(sizeof(JsonContextAdapter) + key.size());
+					} else if(isStale(*item->second)) {
+						item->second->rebind((*m_json)[key]);
+					}
+					return *(item->second.get());
+				}
+
+				/**
+				* Bind the adapter to json, keeping its children for reuse. The children of a pooled adapter are
+				* rebound when they are read, the ones of another adapter are dropped if json is another value.
+				*/
+				void rebind(const json11::Json& json) {
+					if(m_pool != nullptr) {
+						m_epoch = m_pool->epoch;
+					} else if(m_json != &json) {
+						m_children.clear();
+						m_array_items.clear();
+						m_spare_items.clear();
 					}
+					m_json = &json;
+				}
+
+				bool has(const std::string& key) const {
+					return m_json != nullptr && m_json->is_object() && m_json->object_items().count(key) > 0;
+				}
+
+				/**
+				* Identity of the json value, shared by all the documents that share this value.
+				*/
+				std::shared_ptr<const void> getIdentity() const {
+					return m_json != nullptr ? m_json->identity() : nullptr;
 				}
 
 				bool hasParent() const {
@@ -74,15 +120,36 @@ namespace amanite {
 					//Revoir le contrat d'un adapteur pour que n'importe quel conteneur puisse etre utilis... Utiliser les concepts serait cool !
 
 					const json11::Json::array& ai = m_json->array_items();
-					m_array_items.clear();//???
-					//m_array_items.reserve(ai.size());
-					for (const json11::Json& item : ai)
-						m_array_items.emplace_back(item, *this);
+					//the items are rebound in place : the items of a shorter array are kept aside, and given back to
+					//a longer one.
+					if(m_array_items.size() > ai.size())
+						m_spare_items.splice(m_spare_items.end(), m_array_items, std::next(m_array_items.begin(), ai.size()), m_array_items.end());
+					auto it = m_array_items.begin();
+					for (const json11::Json& item : ai) {
+						if(it == m_array_items.end()) {
+							if(!m_spare_items.empty()) {
+								m_array_items.splice(m_array_items.end(), m_spare_items, m_spare_items.begin());
+								it = std::prev(m_array_items.end());
+							} else {
+								it = m_array_items.emplace(m_array_items.end(), item, *this);
+								allocated(sizeof(JsonContextAdapter));
+							}
+						}
+						it->rebind(item);
+						++it;
+					}
 					return m_array_items;
 				}
 
 
 
+				/**
+				* Number of items of the array, without building them.
+				*/
+				std::size_t getArraySize() const {
+					return m_json->array_items().size();
+				}
+
 				bool isString() const{
 					return m_json->is_string();
 				}
@@ -124,6 +191,100 @@ namespace amanite {
 				bool isNull() const{
 					return m_json->is_null();
 				}
+
+			private:
+				bool isStale(const JsonContextAdapter& child) const {
+					return m_pool != nullptr && child.m_epoch != m_pool->epoch;
+				}
+
+				void allocated(std::size_t bytes) const {
+					if(m_pool != nullptr) {
+						++m_pool->adapters;
+						m_pool->bytes += bytes;
+					}
+				}
+			};
+
+			/**
+			* Keeps the adapters of JSON contexts between renders. bind() returns the root adapter of a value, whose
+			* children are the adapters built for the previous values : reading the same keys and items again only
+			* rebinds them, without allocations. The adapters returned by bind() are invalidated by the next call.
+			*
+			* The adapters are invalidated by incrementing the epoch of the pool, whatever the size of the tree : a
+			* stale adapter is rebound when it is read. The tree is freed before a bind if it holds more than
+			* maxAdapters adapters, so the memory of the pool is bounded by the tree of a single render. Not thread
+			* safe : one pool per renderer.
+			*/
+			class JsonContextAdapterPool {
+			public:
+				struct Configuration {
+					Configuration() :
+							maxAdapters(1 << 16) {
+
+					}
+
+					std::size_t maxAdapters;
+				};
+
+				struct Statistics {
+					std::size_t adapters = 0;
+					std::size_t bytes = 0;
+					std::size_t binds = 0;
+					//number of times the tree has been freed for holding more than maxAdapters adapters.
+					std::size_t resets = 0;
+				};
+
+				JsonContextAdapterPool(const Configuration& configuration = Configuration()) : m_configuration(configuration) {
+				}
+
+				JsonContextAdapterPool(const JsonContextAdapterPool&) = delete;
+				JsonContextAdapterPool& operator=(const JsonContextAdapterPool&) = delete;
+
+				const Configuration& getConfiguration() const {
+					return m_configuration;
+				}
+
+				const JsonContextAdapter& bind(const json11::Json& json) {
+					if(m_root != nullptr && m_state.adapters > m_configuration.maxAdapters) {
+						clear();
+						++m_resets;
+					}
+					if(m_root == nullptr) {
+						m_root.reset(new JsonContextAdapter(json));
+						m_root->m_pool = &m_state;
+						m_state.adapters = 1;
+						m_state.bytes = sizeof(JsonContextAdapter);
+					}
+					++m_state.epoch;
+					++m_binds;
+					m_root->rebind(json);
+					return *m_root;
+				}
+
+				/**
+				* Free the adapters.
+				*/
+				void clear() {
+					m_root.reset();
+					m_state.adapters = 0;
+					m_state.bytes = 0;
+				}
+
+				Statistics getStatistics() const {
+					Statistics res;
+					res.adapters = m_state.adapters;
+					res.bytes = m_state.bytes;
+					res.binds = m_binds;
+					res.resets = m_resets;
+					return res;
+				}
+
+			private:
+				Configuration m_configuration;
+				JsonContextAdapterPoolState m_state;
+				std::unique_ptr<JsonContextAdapter> m_root;
+				std::size_t m_binds = 0;
+				std::size_t m_resets = 0;
 			};
 		}
 	}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstddef>
+
+//SSE2 is always available on x86-64. AVX2 has to be enabled when compiling (AMANITE_JSON_AVX2 CMake option).
+#if !defined(AMANITE_JSON_NO_SIMD)
+	#if defined(__AVX2__)
+		#define AMANITE_JSON_SCAN_AVX2
+		#include <immintrin.h>
+	#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		#define AMANITE_JSON_SCAN_SSE2
+		#include <emmintrin.h>
+	#endif
+#endif
+
+#if defined(_MSC_VER)
+	#include <intrin.h>
+#endif
+
+namespace amanite {
+	namespace template_engine {
+		namespace context {
+
+			/**
+			* Scanning primitives shared by the JSON parsers. Each of them looks for the first character of a class
+			* at or after pos, 16 or 32 bytes at a time when SIMD instructions are available, and returns size if
+			* there is none.
+			*/
+			namespace scan {
+
+				inline unsigned firstBit(unsigned mask) {
+#if defined(_MSC_VER)
+					unsigned long res;
+					_BitScanForward(&res, mask);
+					return static_cast<unsigned>(res);
+#else
+					return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+				}
+
+				inline bool isWhitespace(char c) {
+					return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+				}
+
+				inline bool isStringSpecial(char c) {
+					return c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20;
+				}
+
+				inline bool isStructural(char c) {
+					return c == '"' || c == '{' || c == '}' || c == '[' || c == ']';
+				}
+
+#if defined(AMANITE_JSON_SCAN_AVX2)
+				typedef __m256i Block;
+				static const std::size_t blockSize = 32;
+
+				inline Block load(const char* data) {
+					return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+				}
+
+				inline Block equals(Block block, char c) {
+					return _mm256_cmpeq_epi8(block, _mm256_set1_epi8(c));
+				}
+
+				inline Block lessOrEqual(Block block, char c) {
+					return _mm256_cmpeq_epi8(_mm256_max_epu8(block, _mm256_set1_epi8(c)), _mm256_set1_epi8(c));
+				}
+
+				inline Block either(Block a, Block b) {
+					return _mm256_or_si256(a, b);
+				}
+
+				inline unsigned mask(Block block) {
+					return static_cast<unsigned>(_mm256_movemask_epi8(block));
+				}
+#elif defined(AMANITE_JSON_SCAN_SSE2)
+				typedef __m128i Block;
+				static const std::size_t blockSize = 16;
+
+				inline Block load(const char* data) {
+					return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+				}
+
+				inline Block equals(Block block, char c) {
+					return _mm_cmpeq_epi8(block, _mm_set1_epi8(c));
+				}
+
+				inline Block lessOrEqual(Block block, char c) {
+					return _mm_cmpeq_epi8(_mm_max_epu8(block, _mm_set1_epi8(c)), _mm_set1_epi8(c));
+				}
+
+				inline Block either(Block a, Block b) {
+					return _mm_or_si128(a, b);
+				}
+
+				inline unsigned mask(Block block) {
+					return static_cast<unsigned>(_mm_movemask_epi8(block));
+				}
+#endif
+
+				inline std::size_t skipWhitespace(const char* data, std::size_t pos, std::size_t size) {
+					//most values are not preceded by whitespace, or by a single space.
+					if(pos < size && !isWhitespace(data[pos]))
+						return pos;
+#if defined(AMANITE_JSON_SCAN_AVX2) || defined(AMANITE_JSON_SCAN_SSE2)
+					const unsigned full = blockSize == 32 ? 0xFFFFFFFFu : 0xFFFFu;
+					for(; pos + blockSize <= size; pos += blockSize) {
+						Block block = load(data + pos);
+						unsigned whitespaces = mask(either(either(equals(block, ' '), equals(block, '\n')),
+								either(equals(block, '\r'), equals(block, '\t'))));
+						if(whitespaces != full)
+							return pos + firstBit(~whitespaces & full);
+					}
+#endif
+					while(pos < size && isWhitespace(data[pos]))
+						++pos;
+					return pos;
+				}
+
+				/**
+				* Find the end of a run of ordinary string characters : a quote, a backslash or a control character.
+				*/
+				inline std::size_t findStringSpecial(const char* data, std::size_t pos, std::size_t size) {
+#if defined(AMANITE_JSON_SCAN_AVX2) || defined(AMANITE_JSON_SCAN_SSE2)
+					for(; pos + blockSize <= size; pos += blockSize) {
+						Block block = load(data + pos);
+						unsigned specials = mask(either(either(equals(block, '"'), equals(block, '\\')), lessOrEqual(block, 0x1F)));
+						if(specials != 0)
+							return pos + firstBit(specials);
+					}
+#endif
+					while(pos < size && !isStringSpecial(data[pos]))
+						++pos;
+					return pos;
+				}
+
+				/**
+				* Find the next quote or bracket.
+				*/
+				inline std::size_t findStructural(const char* data, std::size_t pos, std::size_t size) {
+#if defined(AMANITE_JSON_SCAN_AVX2) || defined(AMANITE_JSON_SCAN_SSE2)
+					for(; pos + blockSize <= size; pos += blockSize) {
+						Block block = load(data + pos);
+						Block brackets = either(either(equals(block, '{'), equals(block, '}')), either(equals(block, '['), equals(block, ']')));
+						unsigned structurals = mask(either(equals(block, '"'), brackets));
+						if(structurals != 0)
+							return pos + firstBit(structurals);
+					}
+#endif
+					while(pos < size && !isStructural(data[pos]))
+						++pos;
+					return pos;
+				}
+			}
+		}
+	}
+}
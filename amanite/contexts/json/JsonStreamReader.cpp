@@ -0,0 +1,99 @@
+#include "JsonStreamReader.h"
+
+#include <stdexcept>
+
+namespace amanite {
+	namespace template_engine {
+		namespace context {
+
+			JsonStreamReader::JsonStreamReader(std::istream& is, Format format) : m_is(is), m_format(format) {
+			}
+
+			bool JsonStreamReader::next(json11::Json& value) {
+				if(!read())
+					return false;
+				std::string err;
+				value = json11::Json::parse(m_buffer, err);
+				if(!err.empty()) {
+					throw std::runtime_error("Invalid JSON value at " + std::string(m_format == ARRAY ? "item " : "line ")
+							+ std::to_string(m_count) + " : " + err);
+				}
+				return true;
+			}
+
+			bool JsonStreamReader::skip() {
+				return read();
+			}
+
+			bool JsonStreamReader::read() {
+				if(!m_started) {
+					m_started = true;
+					m_is >> std::ws;
+					if(m_format == AUTO)
+						m_format = m_is.peek() == '[' ? ARRAY : NDJSON;
+					if(m_format == ARRAY && m_is.get() != '[')
+						throw std::runtime_error("The JSON stream does not start with an array");
+				}
+				if(m_finished)
+					return false;
+
+				bool res = m_format == ARRAY ? readItem() : readLine();
+				if(res)
+					++m_count;
+				return res;
+			}
+
+			bool JsonStreamReader::readLine() {
+				while(std::getline(m_is, m_buffer)) {
+					if(m_buffer.find_first_not_of(" \t\r") == std::string::npos)
+						continue;
+					return true;
+				}
+				m_finished = true;
+				return false;
+			}
+
+			/**
+			* Accumulate the characters of the next item, until a ',' or the closing ']' of the array is found
+			* outside of any string or nested value.
+			*/
+			bool JsonStreamReader::readItem() {
+				std::streambuf& buf = *m_is.rdbuf();
+				m_buffer.clear();
+				int depth = 0;
+				bool inString = false;
+				for(int c = buf.sbumpc(); c != std::char_traits<char>::eof(); c = buf.sbumpc()) {
+					char ch = static_cast<char>(c);
+					if(inString) {
+						if(ch == '\\') {
+							m_buffer += ch;
+							c = buf.sbumpc();
+							if(c == std::char_traits<char>::eof())
+								break;
+							ch = static_cast<char>(c);
+						} else if(ch == '"') {
+							inString = false;
+						}
+					} else if(ch == '"') {
+						inString = true;
+					} else if(ch == '[' || ch == '{') {
+						++depth;
+					} else if(ch == '}' || (ch == ']' && depth > 0)) {
+						--depth;
+					} else if(depth == 0 && (ch == ',' || ch == ']')) {
+						if(ch == ']')
+							m_finished = true;
+						if(m_buffer.find_first_not_of(" \t\r\n") == std::string::npos) {
+							if(ch == ']' && m_count == 0)
+								return false;
+							throw std::runtime_error("Missing value in JSON array at item " + std::to_string(m_count + 1));
+						}
+						return true;
+					}
+					m_buffer += ch;
+				}
+				throw std::runtime_error("Unexpected end of JSON array");
+			}
+		}
+	}
+}
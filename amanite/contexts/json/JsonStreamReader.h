@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <istream>
+#include <functional>
+
+#include "json11.hpp"
+#include "JsonContextAdapter.h"
+
+namespace amanite {
+	namespace template_engine {
+		namespace context {
+
+			/**
+			* Read JSON values one at a time from a stream, either one value per line (NDJSON) or the items of
+			* a top level array. Only the current value is kept in memory.
+			*/
+			class JsonStreamReader {
+			public:
+				enum Format {
+					//NDJSON, unless the first character of the stream is '['.
+					AUTO,
+					NDJSON,
+					ARRAY
+				};
+
+				JsonStreamReader(std::istream& is, Format format = AUTO);
+
+				/**
+				* Read the next value. Return false at the end of the stream.
+				* Throw a std::runtime_error if the value can not be parsed.
+				*/
+				bool next(json11::Json& value);
+
+				/**
+				* Pass the next value without parsing it. Return false at the end of the stream.
+				*/
+				bool skip();
+
+				/**
+				* Number of values read so far.
+				*/
+				std::size_t getCount() const {
+					return m_count;
+				}
+
+			private:
+				/**
+				* Read the text of the next value into m_buffer.
+				*/
+				bool read();
+				bool readLine();
+				bool readItem();
+
+				std::istream& m_is;
+				Format m_format;
+				bool m_started = false;
+				bool m_finished = false;
+				std::size_t m_count = 0;
+				std::string m_buffer;
+			};
+
+			/**
+			* Section stream, to be given to Renderer::setSectionStream, rendering the values of reader.
+			* Each value is parsed, rendered and discarded in turn. The items have the context of the section
+			* as parent.
+			*/
+			inline std::function<void(const JsonContextAdapter&, const std::function<void(const JsonContextAdapter&)>&)>
+			makeSectionStream(JsonStreamReader& reader) {
+				return [&reader](const JsonContextAdapter& parent, const std::function<void(const JsonContextAdapter&)>& renderItem) {
+					json11::Json value;
+					while(reader.next(value)) {
+						JsonContextAdapter item(value, parent);
+						renderItem(item);
+					}
+				};
+			}
+		}
+	}
+}
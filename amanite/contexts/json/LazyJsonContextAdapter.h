@@ -0,0 +1,146 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <list>
+#include <memory>
+#include <cassert>
+
+#include <boost/utility/string_ref.hpp>
+
+#include "LazyJsonDocument.h"
+
+
+namespace amanite {
+	namespace template_engine {
+		namespace context {
+
+			/**
+			* Context adapter reading a LazyJsonDocument on demand : only the values read by the template are parsed.
+			* The document must outlive the adapter.
+			*/
+			struct LazyJsonContextAdapter {
+				const LazyJsonDocument* m_document = nullptr;
+				std::size_t m_pos = LazyJsonDocument::npos;
+				const LazyJsonContextAdapter* m_parent = nullptr;
+				mutable std::map <std::string, std::unique_ptr<LazyJsonContextAdapter>> m_children;
+				mutable std::list<LazyJsonContextAdapter> m_array_items;
+				mutable bool m_array_items_built = false;
+				//storage for the strings that can not be returned as views into the document.
+				mutable std::string m_string;
+
+				LazyJsonContextAdapter(const LazyJsonDocument& document) : m_document(&document), m_pos(document.getRoot()) { }
+
+				LazyJsonContextAdapter(const LazyJsonDocument& document, std::size_t pos, const LazyJsonContextAdapter& parent)
+						: m_document(&document), m_pos(pos), m_parent(&parent) { }
+
+				const LazyJsonContextAdapter& operator[](const std::string& key) const {
+					return get(key);
+				}
+
+				const LazyJsonContextAdapter& get(const std::string& key) const {
+					auto item = m_children.find(key);
+					if(item == m_children.end()) {
+						std::size_t pos = isObject() ? m_document->findMember(m_pos, key) : LazyJsonDocument::npos;
+						auto& child = m_children[key];
+						child.reset(new LazyJsonContextAdapter(*m_document, pos, *this));
+						return *child;
+					} else {
+						return *(item->second.get());
+					}
+				}
+
+				bool has(const std::string& key) const {
+					return isObject() && m_document->findMember(m_pos, key) != LazyJsonDocument::npos;
+				}
+
+				/**
+				* Identity of the value : its position in the document.
+				*/
+				std::shared_ptr<const void> getIdentity() const {
+					if(m_pos == LazyJsonDocument::npos)
+						return nullptr;
+					return std::shared_ptr<const void>(m_document->shared_from_this(), m_document->getText().data() + m_pos);
+				}
+
+				bool hasParent() const {
+					return m_parent != nullptr;
+				}
+
+				const LazyJsonContextAdapter& getParentContext() const {
+					assert(m_parent != nullptr);
+					return *m_parent;
+				}
+
+				bool isArray() const {
+					return is(LazyJsonDocument::ARRAY);
+				}
+
+				bool isObject() const {
+					return is(LazyJsonDocument::OBJECT);
+				}
+
+				const std::list<LazyJsonContextAdapter>& getAsArray() const {
+					//the document is immutable, so the items are built only once.
+					if(!m_array_items_built) {
+						for(std::size_t pos : m_document->getItems(m_pos))
+							m_array_items.emplace_back(*m_document, pos, *this);
+						m_array_items_built = true;
+					}
+					return m_array_items;
+				}
+
+				std::size_t getArraySize() const {
+					return isArray() ? getAsArray().size() : 0;
+				}
+
+				bool isString() const{
+					return is(LazyJsonDocument::STRING);
+				}
+
+				/**
+				* Same text as JsonContextAdapter::getAsString, except for arrays and objects which are returned
+				* as they are written in the document.
+				*/
+				boost::string_ref getAsString() const {
+					if(m_pos == LazyJsonDocument::npos)
+						return "null";
+					switch(m_document->getType(m_pos)) {
+						case LazyJsonDocument::STRING:
+							return m_document->getString(m_pos, m_string);
+						case LazyJsonDocument::NUMBER:
+							m_string = std::to_string(getAsDouble());
+							return m_string;
+						default:
+							return m_document->getRaw(m_pos);
+					}
+				}
+
+				bool isDouble() const{
+					return is(LazyJsonDocument::NUMBER);
+				}
+
+				double getAsDouble() const{
+					return isDouble() ? m_document->getNumber(m_pos) : 0;
+				}
+
+				bool isBoolean() const{
+					return is(LazyJsonDocument::BOOL);
+				}
+
+				bool getAsBoolean() const{
+					return isBoolean() && m_document->getBoolean(m_pos);
+				}
+
+				bool isNull() const{
+					return m_pos == LazyJsonDocument::npos || is(LazyJsonDocument::NUL);
+				}
+
+			private:
+				bool is(LazyJsonDocument::Type type) const {
+					return m_pos != LazyJsonDocument::npos && m_document->getType(m_pos) == type;
+				}
+			};
+		}
+	}
+}
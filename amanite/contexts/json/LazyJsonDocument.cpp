@@ -0,0 +1,185 @@
+#include "LazyJsonDocument.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+#include "json11.hpp"
+#include "JsonScan.h"
+
+namespace amanite {
+	namespace template_engine {
+		namespace context {
+
+			const std::size_t LazyJsonDocument::npos;
+
+			std::shared_ptr<LazyJsonDocument> LazyJsonDocument::fromBuffer(const char* data, std::size_t size) {
+				std::shared_ptr<LazyJsonDocument> res(new LazyJsonDocument(data, size));
+				res->buildIndex();
+				return res;
+			}
+
+			std::shared_ptr<LazyJsonDocument> LazyJsonDocument::fromFile(const std::string& fileName) {
+				std::shared_ptr<LazyJsonDocument> res(new LazyJsonDocument(nullptr, 0));
+				res->m_file.open(fileName);
+				if(!res->m_file.is_open())
+					throw std::invalid_argument("The file " + fileName + " can not be mapped.");
+				res->m_data = res->m_file.data();
+				res->m_size = res->m_file.size();
+				res->buildIndex();
+				return res;
+			}
+
+			LazyJsonDocument::LazyJsonDocument(const char* data, std::size_t size)
+					: m_data(data), m_size(size), m_root(npos) {
+			}
+
+			/**
+			* Single pass over the text, matching the brackets that are not in strings.
+			*/
+			void LazyJsonDocument::buildIndex() {
+				std::vector<std::size_t> openContainers;
+				for(std::size_t pos = scan::findStructural(m_data, 0, m_size); pos < m_size; pos = scan::findStructural(m_data, pos + 1, m_size)) {
+					switch(m_data[pos]) {
+						case '"':
+							pos = skipString(pos) - 1;
+							break;
+						case '{':
+						case '[':
+							openContainers.push_back(m_containerStarts.size());
+							m_containerStarts.push_back(pos);
+							m_containerEnds.push_back(npos);
+							break;
+						case '}':
+						case ']':
+							if(openContainers.empty())
+								throw std::runtime_error("Unbalanced JSON text at position " + std::to_string(pos));
+							m_containerEnds[openContainers.back()] = pos;
+							openContainers.pop_back();
+							break;
+					}
+				}
+				if(!openContainers.empty())
+					throw std::runtime_error("Unexpected end of JSON text");
+
+				m_root = skipWhitespace(0);
+				if(m_root == m_size)
+					throw std::runtime_error("Empty JSON text");
+			}
+
+			std::size_t LazyJsonDocument::skipWhitespace(std::size_t pos) const {
+				return scan::skipWhitespace(m_data, pos, m_size);
+			}
+
+			/**
+			* Position following the string starting at pos.
+			*/
+			std::size_t LazyJsonDocument::skipString(std::size_t pos) const {
+				for(pos = scan::findStringSpecial(m_data, pos + 1, m_size); pos < m_size; pos = scan::findStringSpecial(m_data, pos + 1, m_size)) {
+					if(m_data[pos] == '\\')
+						++pos;
+					else if(m_data[pos] == '"')
+						return pos + 1;
+				}
+				throw std::runtime_error("Unexpected end of JSON text in string");
+			}
+
+			LazyJsonDocument::Type LazyJsonDocument::getType(std::size_t pos) const {
+				switch(m_data[pos]) {
+					case '{':
+						return OBJECT;
+					case '[':
+						return ARRAY;
+					case '"':
+						return STRING;
+					case 't':
+					case 'f':
+						return BOOL;
+					case 'n':
+						return NUL;
+					default:
+						return NUMBER;
+				}
+			}
+
+			std::size_t LazyJsonDocument::skipValue(std::size_t pos) const {
+				switch(m_data[pos]) {
+					case '{':
+					case '[': {
+						auto start = std::lower_bound(m_containerStarts.begin(), m_containerStarts.end(), pos);
+						return m_containerEnds[start - m_containerStarts.begin()] + 1;
+					}
+					case '"':
+						return skipString(pos);
+					default:
+						while(pos < m_size && std::strchr(",}] \t\n\r", m_data[pos]) == nullptr)
+							++pos;
+						return pos;
+				}
+			}
+
+			std::size_t LazyJsonDocument::findMember(std::size_t pos, boost::string_ref key) const {
+				if(pos == npos || m_data[pos] != '{')
+					return npos;
+				std::string buffer;
+				pos = skipWhitespace(pos + 1);
+				while(pos < m_size && m_data[pos] == '"') {
+					std::size_t keyEnd = skipString(pos);
+					bool found = getString(pos, buffer) == key;
+					pos = skipWhitespace(skipWhitespace(keyEnd) + 1);
+					if(found)
+						return pos;
+					pos = skipWhitespace(skipValue(pos));
+					if(pos < m_size && m_data[pos] == ',')
+						pos = skipWhitespace(pos + 1);
+				}
+				return npos;
+			}
+
+			std::vector<std::size_t> LazyJsonDocument::getItems(std::size_t pos) const {
+				std::vector<std::size_t> res;
+				if(pos == npos || m_data[pos] != '[')
+					return res;
+				pos = skipWhitespace(pos + 1);
+				while(pos < m_size && m_data[pos] != ']') {
+					res.push_back(pos);
+					pos = skipWhitespace(skipValue(pos));
+					if(pos < m_size && m_data[pos] == ',')
+						pos = skipWhitespace(pos + 1);
+				}
+				return res;
+			}
+
+			boost::string_ref LazyJsonDocument::getRaw(std::size_t pos) const {
+				return boost::string_ref(m_data + pos, skipValue(pos) - pos);
+			}
+
+			boost::string_ref LazyJsonDocument::getString(std::size_t pos, std::string& buffer) const {
+				boost::string_ref raw = getRaw(pos);
+				boost::string_ref content = raw.substr(1, raw.size() - 2);
+				if(content.find('\\') == boost::string_ref::npos)
+					return content;
+
+				//escape sequences are decoded by json11, so that both JSON contexts read the same strings.
+				std::string err;
+				buffer = json11::Json::parse(std::string(raw.data(), raw.size()), err).string_value();
+				if(!err.empty())
+					throw std::runtime_error("Invalid JSON string : " + err);
+				return buffer;
+			}
+
+			double LazyJsonDocument::getNumber(std::size_t pos) const {
+				boost::string_ref raw = getRaw(pos);
+				std::string err;
+				double res = json11::Json::parse(std::string(raw.data(), raw.size()), err).number_value();
+				if(!err.empty())
+					throw std::runtime_error("Invalid JSON number : " + err);
+				return res;
+			}
+
+			bool LazyJsonDocument::getBoolean(std::size_t pos) const {
+				return m_data[pos] == 't';
+			}
+		}
+	}
+}
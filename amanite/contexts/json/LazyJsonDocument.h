@@ -0,0 +1,103 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+#include <boost/utility/string_ref.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+namespace amanite {
+	namespace template_engine {
+		namespace context {
+
+			/**
+			* JSON text indexed for on-demand access.
+			*
+			* Loading a document only records where each object and array ends, so that values can be skipped
+			* without being parsed. Values are parsed when they are accessed, and strings without escape
+			* sequences are returned as views into the text.
+			*
+			* The text is either a memory-mapped file, owned by the document, or a buffer owned by the caller.
+			*/
+			class LazyJsonDocument : public std::enable_shared_from_this<LazyJsonDocument> {
+			public:
+				static const std::size_t npos = static_cast<std::size_t>(-1);
+
+				enum Type {
+					NUL, NUMBER, BOOL, STRING, ARRAY, OBJECT
+				};
+
+				/**
+				* Index a buffer. The buffer must outlive the document.
+				*/
+				static std::shared_ptr<LazyJsonDocument> fromBuffer(const char* data, std::size_t size);
+
+				/**
+				* Map a file in memory and index it.
+				*/
+				static std::shared_ptr<LazyJsonDocument> fromFile(const std::string& fileName);
+
+				/**
+				* Position of the root value.
+				*/
+				std::size_t getRoot() const {
+					return m_root;
+				}
+
+				boost::string_ref getText() const {
+					return boost::string_ref(m_data, m_size);
+				}
+
+				Type getType(std::size_t pos) const;
+
+				/**
+				* Position following the value at pos.
+				*/
+				std::size_t skipValue(std::size_t pos) const;
+
+				/**
+				* Position of the value bound to key in the object at pos, or npos.
+				*/
+				std::size_t findMember(std::size_t pos, boost::string_ref key) const;
+
+				/**
+				* Positions of the items of the array at pos.
+				*/
+				std::vector<std::size_t> getItems(std::size_t pos) const;
+
+				/**
+				* Raw text of the value at pos.
+				*/
+				boost::string_ref getRaw(std::size_t pos) const;
+
+				/**
+				* Content of the string at pos. The view points into the text if the string has no escape
+				* sequence, into buffer otherwise.
+				*/
+				boost::string_ref getString(std::size_t pos, std::string& buffer) const;
+
+				double getNumber(std::size_t pos) const;
+
+				bool getBoolean(std::size_t pos) const;
+
+			private:
+				LazyJsonDocument(const char* data, std::size_t size);
+
+				void buildIndex();
+				std::size_t skipWhitespace(std::size_t pos) const;
+				std::size_t skipString(std::size_t pos) const;
+
+				boost::iostreams::mapped_file_source m_file;
+				const char* m_data;
+				std::size_t m_size;
+				std::size_t m_root;
+
+				//positions of the opening and closing characters of every object and array, sorted.
+				std::vector<std::size_t> m_containerStarts;
+				std::vector<std::size_t> m_containerEnds;
+			};
+		}
+	}
+}
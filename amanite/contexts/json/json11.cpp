@@ -20,6 +20,7 @@
  */
 
 #include "json11.hpp"
+#include "JsonScan.h"
 #include <cassert>
 #include <cmath>
 #include <cstdlib>
@@ -41,7 +42,12 @@ using std::move;
  * Serialization
  */
 
-static void dump(std::nullptr_t, string &out) {
+struct NullStruct {
+    bool operator==(NullStruct) const { return true; }
+    bool operator<(NullStruct) const { return false; }
+};
+
+static void dump(NullStruct, string &out) {
     out += "null";
 }
 
@@ -208,9 +214,9 @@ public:
     explicit JsonObject(Json::object &&value)      : Value(move(value)) {}
 };
 
-class JsonNull final : public Value<Json::NUL, std::nullptr_t> {
+class JsonNull final : public Value<Json::NUL, NullStruct> {
 public:
-    JsonNull() : Value(nullptr) {}
+    JsonNull() : Value({}) {}
 };
 
 /* * * * * * * * * * * * * * * * * * * *
@@ -360,8 +366,7 @@ struct JsonParser {
      * Advance until the current character is non-whitespace.
      */
     void consume_whitespace() {
-        while (str[i] == ' ' || str[i] == '\r' || str[i] == '\n' || str[i] == '\t')
-            i++;
+        i = amanite::template_engine::context::scan::skipWhitespace(str.data(), i, str.size());
     }
 
     /* get_next_token()
@@ -410,6 +415,15 @@ struct JsonParser {
         string out;
         long last_escaped_codepoint = -1;
         while (true) {
+            // Copy the run of non-escaped characters at once
+            size_t run_end = amanite::template_engine::context::scan::findStringSpecial(str.data(), i, str.size());
+            if (run_end != i) {
+                encode_utf8(last_escaped_codepoint, out);
+                last_escaped_codepoint = -1;
+                out.append(str, i, run_end - i);
+                i = run_end;
+            }
+
             if (i == str.size())
                 return fail("unexpected end of input in string", "");
 
@@ -145,6 +145,10 @@ public:
     // Return a reference to obj[key] if this is an object, Json() otherwise.
     const Json & operator[](const std::string &key) const;
 
+    // Return the shared value behind this Json. Copies of a Json share the same identity, and
+    // holding the identity keeps the value alive, so it can not be reused by another value.
+    std::shared_ptr<const void> identity() const { return m_ptr; }
+
     // Serialize.
     void dump(std::string &out) const;
     std::string dump() const {
@@ -0,0 +1,545 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <algorithm>
+#include <initializer_list>
+#include <type_traits>
+#include <iterator>
+#include <cstring>
+#include <cstdio>
+#include <cassert>
+
+#include <boost/utility/string_ref.hpp>
+
+
+namespace amanite {
+	namespace template_engine {
+		namespace context {
+
+			/**
+			* Description of the C++ types a NativeContextAdapter can read. Each type has a static table of
+			* functions, generated at compile time, so that one adapter type reads any of them.
+			*/
+			namespace native {
+
+				struct Type;
+
+				/**
+				* An object and the description of its type.
+				*/
+				struct Value {
+					const void* object;
+					const Type* type;
+				};
+
+				struct Type {
+					enum Kind {
+						NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT
+					};
+
+					Kind kind;
+					bool (*boolean)(const void* object);
+					double (*number)(const void* object);
+					boost::string_ref (*string)(const void* object);
+					std::size_t (*size)(const void* object);
+					Value (*item)(const void* object, std::size_t index);
+					//a value with a null object if the key is not found.
+					Value (*member)(const void* object, const std::string& key);
+				};
+
+				template <class T, class Enable = void>
+				struct TypeOf;
+
+				inline const Type& nullType() {
+					static const Type type = { Type::NUL, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
+					return type;
+				}
+
+				inline Value nullValue() {
+					return Value{nullptr, &nullType()};
+				}
+
+				/**
+				* Pointers are followed : the value is the object they point to, or null.
+				*/
+				template <class T>
+				Value makeValue(const T& object) {
+					return Value{&object, &TypeOf<T>::get()};
+				}
+
+				template <class T>
+				Value makeValue(T* const& pointer) {
+					return pointer != nullptr ? makeValue(*pointer) : nullValue();
+				}
+
+				template <class T>
+				Value makeValue(const std::shared_ptr<T>& pointer) {
+					return pointer != nullptr ? makeValue(*pointer) : nullValue();
+				}
+
+				template <class T, class D>
+				Value makeValue(const std::unique_ptr<T, D>& pointer) {
+					return pointer != nullptr ? makeValue(*pointer) : nullValue();
+				}
+
+				inline Value makeValue(const char* const& string);
+
+				/**
+				* Field of a reflected structure.
+				*/
+				struct Field {
+					const char* name;
+					Value (*get)(const void* object);
+				};
+
+				template <class T, class F, F T::*member>
+				Value getField(const void* object) {
+					return makeValue(static_cast<const T*>(object)->*member);
+				}
+
+				template <class T, class F, F T::*member>
+				Field makeField(const char* name) {
+					return Field{name, &getField<T, F, member>};
+				}
+
+				/**
+				* Fields of a reflected structure, sorted by name.
+				*/
+				class Fields {
+				public:
+					Fields(std::initializer_list<Field> fields) : m_fields(fields) {
+						std::sort(m_fields.begin(), m_fields.end(), [](const Field& a, const Field& b) {
+							return std::strcmp(a.name, b.name) < 0;
+						});
+					}
+
+					const Field* find(const std::string& name) const {
+						auto field = std::lower_bound(m_fields.begin(), m_fields.end(), name, [](const Field& a, const std::string& b) {
+							return b.compare(a.name) > 0;
+						});
+						return field != m_fields.end() && name.compare(field->name) == 0 ? &*field : nullptr;
+					}
+
+				private:
+					std::vector<Field> m_fields;
+				};
+
+				/**
+				* Structures declared with AMANITE_REFLECT. The fields are found through the amanite_fields function
+				* declared by the macro in the namespace of the structure.
+				*/
+				template <class T, class Enable>
+				struct TypeOf {
+					static Value member(const void* object, const std::string& key) {
+						const Field* field = amanite_fields(static_cast<const T*>(nullptr)).find(key);
+						return field != nullptr ? field->get(object) : nullValue();
+					}
+
+					static const Type& get() {
+						static const Type type = { Type::OBJECT, nullptr, nullptr, nullptr, nullptr, nullptr, &member };
+						return type;
+					}
+				};
+
+				template <>
+				struct TypeOf<bool> {
+					static bool boolean(const void* object) {
+						return *static_cast<const bool*>(object);
+					}
+
+					static const Type& get() {
+						static const Type type = { Type::BOOLEAN, &boolean, nullptr, nullptr, nullptr, nullptr, nullptr };
+						return type;
+					}
+				};
+
+				template <class T>
+				struct TypeOf<T, typename std::enable_if<std::is_arithmetic<T>::value>::type> {
+					static double number(const void* object) {
+						return static_cast<double>(*static_cast<const T*>(object));
+					}
+
+					static const Type& get() {
+						static const Type type = { Type::NUMBER, nullptr, &number, nullptr, nullptr, nullptr, nullptr };
+						return type;
+					}
+				};
+
+				template <class T>
+				struct TypeOf<T, typename std::enable_if<std::is_enum<T>::value>::type> {
+					static double number(const void* object) {
+						return static_cast<double>(*static_cast<const T*>(object));
+					}
+
+					static const Type& get() {
+						static const Type type = { Type::NUMBER, nullptr, &number, nullptr, nullptr, nullptr, nullptr };
+						return type;
+					}
+				};
+
+				template <>
+				struct TypeOf<std::string> {
+					static boost::string_ref string(const void* object) {
+						return *static_cast<const std::string*>(object);
+					}
+
+					static const Type& get() {
+						static const Type type = { Type::STRING, nullptr, nullptr, &string, nullptr, nullptr, nullptr };
+						return type;
+					}
+				};
+
+				template <>
+				struct TypeOf<boost::string_ref> {
+					static boost::string_ref string(const void* object) {
+						return *static_cast<const boost::string_ref*>(object);
+					}
+
+					static const Type& get() {
+						static const Type type = { Type::STRING, nullptr, nullptr, &string, nullptr, nullptr, nullptr };
+						return type;
+					}
+				};
+
+				/**
+				* C strings are read through their pointer, to which the value points.
+				*/
+				struct CString {
+					static boost::string_ref string(const void* object) {
+						return *static_cast<const char* const*>(object);
+					}
+
+					static const Type& get() {
+						static const Type type = { Type::STRING, nullptr, nullptr, &string, nullptr, nullptr, nullptr };
+						return type;
+					}
+				};
+
+				inline Value makeValue(const char* const& string) {
+					return string != nullptr ? Value{&string, &CString::get()} : nullValue();
+				}
+
+				template <class T, class A>
+				struct TypeOf<std::vector<T, A>> {
+					static std::size_t size(const void* object) {
+						return static_cast<const std::vector<T, A>*>(object)->size();
+					}
+
+					static Value item(const void* object, std::size_t index) {
+						return makeValue((*static_cast<const std::vector<T, A>*>(object))[index]);
+					}
+
+					static const Type& get() {
+						static const Type type = { Type::ARRAY, nullptr, nullptr, nullptr, &size, &item, nullptr };
+						return type;
+					}
+				};
+
+				/**
+				* The items of std::vector<bool> are not objects : they are read as the addresses of constants.
+				*/
+				template <class A>
+				struct TypeOf<std::vector<bool, A>> {
+					static std::size_t size(const void* object) {
+						return static_cast<const std::vector<bool, A>*>(object)->size();
+					}
+
+					static Value item(const void* object, std::size_t index) {
+						static const bool values[] = { false, true };
+						return makeValue(values[(*static_cast<const std::vector<bool, A>*>(object))[index] ? 1 : 0]);
+					}
+
+					static const Type& get() {
+						static const Type type = { Type::ARRAY, nullptr, nullptr, nullptr, &size, &item, nullptr };
+						return type;
+					}
+				};
+
+				template <class Map>
+				struct MapType {
+					static Value member(const void* object, const std::string& key) {
+						const Map& map = *static_cast<const Map*>(object);
+						auto item = map.find(key);
+						return item != map.end() ? makeValue(item->second) : nullValue();
+					}
+
+					static const Type& get() {
+						static const Type type = { Type::OBJECT, nullptr, nullptr, nullptr, nullptr, nullptr, &member };
+						return type;
+					}
+				};
+
+				template <class T, class C, class A>
+				struct TypeOf<std::map<std::string, T, C, A>> : MapType<std::map<std::string, T, C, A>> {
+				};
+
+				template <class T, class H, class E, class A>
+				struct TypeOf<std::unordered_map<std::string, T, H, E, A>> : MapType<std::unordered_map<std::string, T, H, E, A>> {
+				};
+			}
+
+			/**
+			* Context adapter reading C++ objects in place : structures declared with AMANITE_REFLECT, std::vector,
+			* std::map and std::unordered_map with string keys, strings, numbers, booleans and enums. Pointers, including
+			* smart pointers, are followed, a null pointer being a null value.
+			*
+			* Like BinaryContextAdapter, children are returned by value and refer to the adapter they have been read from.
+			* Strings are returned as views on the objects and numbers are written as JsonContextAdapter does, so that
+			* templates render the same text as with the JSON serialization of the objects.
+			* The objects must outlive the adapter, and must not change while a fragment cache is in use, since the
+			* identity of a value is its address.
+			*/
+			class NativeContextAdapter {
+			public:
+				class Items;
+
+				template <class T>
+				explicit NativeContextAdapter(const T& object) : m_value(native::makeValue(object)) { }
+
+				NativeContextAdapter(native::Value value, const NativeContextAdapter& parent) : m_value(value), m_parent(&parent) { }
+
+				NativeContextAdapter operator[](const std::string& key) const {
+					return get(key);
+				}
+
+				NativeContextAdapter get(const std::string& key) const {
+					return NativeContextAdapter(isObject() ? m_value.type->member(m_value.object, key) : native::nullValue(), *this);
+				}
+
+				bool has(const std::string& key) const {
+					return isObject() && m_value.type->member(m_value.object, key).object != nullptr;
+				}
+
+				/**
+				* Identity of the value : its address. The objects are not owned by the identity.
+				*/
+				std::shared_ptr<const void> getIdentity() const {
+					if(m_value.object == nullptr)
+						return nullptr;
+					return std::shared_ptr<const void>(std::shared_ptr<const void>(), m_value.object);
+				}
+
+				bool hasParent() const {
+					return m_parent != nullptr;
+				}
+
+				const NativeContextAdapter& getParentContext() const {
+					assert(m_parent != nullptr);
+					return *m_parent;
+				}
+
+				bool isArray() const {
+					return m_value.type->kind == native::Type::ARRAY;
+				}
+
+				bool isObject() const {
+					return m_value.type->kind == native::Type::OBJECT;
+				}
+
+				/**
+				* The items have this adapter as parent, like the items of a JsonContextAdapter.
+				*/
+				Items getAsArray() const;
+
+				std::size_t getArraySize() const {
+					return isArray() ? m_value.type->size(m_value.object) : 0;
+				}
+
+				bool isString() const {
+					return m_value.type->kind == native::Type::STRING;
+				}
+
+				/**
+				* Same text as JsonContextAdapter::getAsString, except for arrays and objects which give an empty string.
+				*/
+				boost::string_ref getAsString() const {
+					switch(m_value.type->kind) {
+						case native::Type::STRING:
+							return m_value.type->string(m_value.object);
+						case native::Type::NUMBER:
+							return formatNumber();
+						case native::Type::BOOLEAN:
+							return getAsBoolean() ? "true" : "false";
+						case native::Type::NUL:
+							return "null";
+						default:
+							return boost::string_ref();
+					}
+				}
+
+				bool isDouble() const {
+					return m_value.type->kind == native::Type::NUMBER;
+				}
+
+				double getAsDouble() const {
+					return isDouble() ? m_value.type->number(m_value.object) : 0;
+				}
+
+				bool isBoolean() const {
+					return m_value.type->kind == native::Type::BOOLEAN;
+				}
+
+				bool getAsBoolean() const {
+					return isBoolean() && m_value.type->boolean(m_value.object);
+				}
+
+				bool isNull() const {
+					return m_value.type->kind == native::Type::NUL;
+				}
+
+			private:
+				boost::string_ref formatNumber() const {
+					double value = getAsDouble();
+					int length = std::snprintf(m_number, sizeof(m_number), "%f", value);
+					if(length >= 0 && static_cast<std::size_t>(length) < sizeof(m_number))
+						return boost::string_ref(m_number, length);
+					m_largeNumber = std::to_string(value);
+					return m_largeNumber;
+				}
+
+				native::Value m_value;
+				const NativeContextAdapter* m_parent = nullptr;
+				mutable char m_number[32];
+				mutable std::string m_largeNumber;
+			};
+
+			/**
+			* Items of an array, built when the range is iterated.
+			*/
+			class NativeContextAdapter::Items {
+			public:
+				class iterator {
+				public:
+					typedef std::input_iterator_tag iterator_category;
+					typedef NativeContextAdapter value_type;
+					typedef std::ptrdiff_t difference_type;
+					typedef void pointer;
+					typedef NativeContextAdapter reference;
+
+					iterator(const NativeContextAdapter& array, std::size_t index) : m_array(&array), m_index(index) { }
+
+					NativeContextAdapter operator*() const {
+						const native::Value& value = m_array->m_value;
+						return NativeContextAdapter(value.type->item(value.object, m_index), *m_array);
+					}
+
+					iterator& operator++() {
+						++m_index;
+						return *this;
+					}
+
+					iterator operator++(int) {
+						iterator res = *this;
+						++m_index;
+						return res;
+					}
+
+					bool operator==(const iterator& other) const {
+						return m_index == other.m_index;
+					}
+
+					bool operator!=(const iterator& other) const {
+						return m_index != other.m_index;
+					}
+
+				private:
+					const NativeContextAdapter* m_array;
+					std::size_t m_index;
+				};
+
+				typedef iterator const_iterator;
+
+				Items(const NativeContextAdapter& array, std::size_t size) : m_array(&array), m_size(size) { }
+
+				iterator begin() const {
+					return iterator(*m_array, 0);
+				}
+
+				iterator end() const {
+					return iterator(*m_array, m_size);
+				}
+
+				std::size_t size() const {
+					return m_size;
+				}
+
+				bool empty() const {
+					return m_size == 0;
+				}
+
+			private:
+				const NativeContextAdapter* m_array;
+				std::size_t m_size;
+			};
+
+			inline NativeContextAdapter::Items NativeContextAdapter::getAsArray() const {
+				return Items(*this, isArray() ? m_value.type->size(m_value.object) : 0);
+			}
+		}
+	}
+}
+
+/**
+* Expose the public fields of a structure to NativeContextAdapter, up to 32 fields :
+*
+*   namespace shop {
+*       struct Item { std::string name; double price; std::vector<std::string> tags; };
+*       AMANITE_REFLECT(Item, name, price, tags)
+*   }
+*
+* The macro has to be used in the namespace of the structure, where it declares the amanite_fields function.
+*/
+#define AMANITE_REFLECT(Type, ...) \
+	inline const ::amanite::template_engine::context::native::Fields& amanite_fields(const Type*) { \
+		static const ::amanite::template_engine::context::native::Fields fields({ \
+			AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_CONCAT(AMANITE_REFLECT_FIELDS_, AMANITE_REFLECT_COUNT(__VA_ARGS__))(Type, __VA_ARGS__)) \
+		}); \
+		return fields; \
+	}
+
+//the expansions are needed by the MSVC preprocessor, which passes __VA_ARGS__ as a single argument.
+#define AMANITE_REFLECT_EXPAND(x) x
+#define AMANITE_REFLECT_CONCAT(a, b) AMANITE_REFLECT_CONCAT_(a, b)
+#define AMANITE_REFLECT_CONCAT_(a, b) a##b
+#define AMANITE_REFLECT_FIELD(Type, field) \
+	::amanite::template_engine::context::native::makeField<Type, decltype(Type::field), &Type::field>(#field)
+
+#define AMANITE_REFLECT_FIELDS_1(Type, field) AMANITE_REFLECT_FIELD(Type, field)
+#define AMANITE_REFLECT_FIELDS_2(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_1(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_3(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_2(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_4(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_3(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_5(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_4(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_6(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_5(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_7(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_6(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_8(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_7(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_9(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_8(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_10(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_9(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_11(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_10(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_12(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_11(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_13(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_12(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_14(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_13(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_15(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_14(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_16(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_15(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_17(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_16(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_18(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_17(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_19(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_18(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_20(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_19(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_21(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_20(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_22(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_21(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_23(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_22(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_24(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_23(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_25(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_24(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_26(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_25(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_27(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_26(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_28(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_27(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_29(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_28(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_30(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_29(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_31(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_30(Type, __VA_ARGS__))
+#define AMANITE_REFLECT_FIELDS_32(Type, field, ...) AMANITE_REFLECT_FIELD(Type, field), AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_FIELDS_31(Type, __VA_ARGS__))
+
+#define AMANITE_REFLECT_COUNT(...) AMANITE_REFLECT_EXPAND(AMANITE_REFLECT_COUNT_(__VA_ARGS__, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1))
+#define AMANITE_REFLECT_COUNT_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, N, ...) N
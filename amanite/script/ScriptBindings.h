@@ -0,0 +1,46 @@
+#pragma once
+
+#include <set>
+
+#include <chaiscript/chaiscript.hpp>
+#include <chaiscript/utility/utility.hpp>
+
+#include "ScriptEngine.h"
+
+/**
+* Instantiate the binding of a context type, for a Renderer of this type. To be used once, at global scope.
+*/
+#define AMANITE_SCRIPT_BIND_CONTEXT(Context) \
+	template void amanite::script::ScriptEngine::bindVariable<const Context>(const Context&, const std::string&);
+
+namespace amanite {
+	namespace script {
+
+		template <class T>
+		void ScriptEngine::bindVariable(T& v, const std::string& varName) {
+			getChaiScript().add(chaiscript::var(&v), varName);
+		}
+
+		template<class Class>
+		void ScriptEngine::registerClass(const std::string& className) {
+			static bool added = false;
+			if(!added) {
+				getChaiScript().add(chaiscript::user_type<Class>(), className);
+				added = true;
+			}else{
+				throw ScriptEngine::Exception("Class already registered.");
+			}
+		}
+
+		template <class T>
+		void ScriptEngine::registerFunction(const T& f, const std::string& funcName) {
+			static std::set<std::string> m_addedFunctions;
+			if(m_addedFunctions.find(funcName) == m_addedFunctions.end()) {
+				getChaiScript().add(chaiscript::fun(f), funcName);
+				m_addedFunctions.insert(funcName);
+			}else{
+				throw ScriptEngine::Exception("Function name already registered.");
+			}
+		}
+	}
+}
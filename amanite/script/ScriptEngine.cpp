@@ -0,0 +1,50 @@
+#include "ScriptBindings.h"
+
+#include <chaiscript/chaiscript_stdlib.hpp>
+
+#include "StdLib.h"
+#include "amanite/contexts/json/JsonContextAdapter.h"
+#include "amanite/contexts/json/LazyJsonContextAdapter.h"
+#include "amanite/contexts/binary/BinaryContextAdapter.h"
+#include "amanite/contexts/native/NativeContextAdapter.h"
+
+namespace amanite {
+	namespace script {
+
+		ScriptEngine::ScriptEngine() {
+		}
+
+		ScriptEngine::~ScriptEngine() {
+		}
+
+		void ScriptEngine::eval(const std::string& code) {
+			getChaiScript().eval(code);
+		}
+
+		void ScriptEngine::bindOutput(std::ostream& os) {
+			getChaiScript().add(chaiscript::var(&os), "out");
+		}
+
+		void ScriptEngine::setCancellationCheck(std::function<bool()> check) {
+			m_cancellationCheck = std::move(check);
+		}
+
+		bool ScriptEngine::isCancelled() const {
+			return m_cancellationCheck != nullptr && m_cancellationCheck();
+		}
+
+		chaiscript::ChaiScript& ScriptEngine::getChaiScript() {
+			if(m_chai == nullptr) {
+				m_chai.reset(new chaiscript::ChaiScript(chaiscript::Std_Lib::library()));
+				m_chai->add(stdlib::create());
+				m_chai->add(chaiscript::fun(&ScriptEngine::isCancelled, this), "cancelled");
+			}
+			return *m_chai;
+		}
+	}
+}
+
+AMANITE_SCRIPT_BIND_CONTEXT(amanite::template_engine::context::JsonContextAdapter)
+AMANITE_SCRIPT_BIND_CONTEXT(amanite::template_engine::context::LazyJsonContextAdapter)
+AMANITE_SCRIPT_BIND_CONTEXT(amanite::template_engine::context::BinaryContextAdapter)
+AMANITE_SCRIPT_BIND_CONTEXT(amanite::template_engine::context::NativeContextAdapter)
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+
+namespace chaiscript {
+	class ChaiScript;
+}
+
+namespace amanite {
+	namespace script {
+
+		/**
+		* Script engine running the code nodes, compiled in the AmaniteScript library : only ScriptBindings.h and
+		* the library include ChaiScript. The ChaiScript engine, with its standard library and the amanite one
+		* (see StdLib.h), is built the first time it is used.
+		*
+		* The templates below are defined in ScriptBindings.h. bindVariable is instantiated by the library for the
+		* context adapters of amanite; a Renderer of another context type needs AMANITE_SCRIPT_BIND_CONTEXT in one
+		* translation unit.
+		*/
+		class ScriptEngine {
+		public:
+			ScriptEngine();
+			~ScriptEngine();
+
+			ScriptEngine(const ScriptEngine&) = delete;
+			ScriptEngine& operator=(const ScriptEngine&) = delete;
+
+			void eval(const std::string& code);
+
+			/**
+			* Bind os to the variable "out" of the scripts.
+			*/
+			void bindOutput(std::ostream& os);
+
+			/**
+			* Function returned by the script function cancelled(), for the scripts to stop early. A script can not
+			* be interrupted otherwise.
+			*/
+			void setCancellationCheck(std::function<bool()> check);
+
+			template <class T>
+			void bindVariable(T& v, const std::string& varName);
+
+			template<class Class>
+			void registerClass(const std::string& className);
+
+			template <class T>
+			void registerFunction(const T& f, const std::string& funcName);
+
+			template <class T>
+			void registerVariable(T& v, const std::string& varName) {
+				bindVariable(v, varName);
+			}
+
+			chaiscript::ChaiScript& getChaiScript();
+
+			///Exceptions
+
+			class Exception : public std::runtime_error{
+			public:
+				Exception(const std::string& message) : std::runtime_error(message.c_str()){
+
+				}
+			};
+
+		private:
+			bool isCancelled() const;
+
+			std::unique_ptr<chaiscript::ChaiScript> m_chai;
+			std::function<bool()> m_cancellationCheck;
+		};
+	}
+}
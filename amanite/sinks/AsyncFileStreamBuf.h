@@ -0,0 +1,385 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <streambuf>
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define AMANITE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+namespace amanite {
+	namespace template_engine {
+		namespace sink {
+
+			/**
+			* Stream buffer writing a file asynchronously : a full buffer is submitted to io_uring, and rendering goes
+			* on in the next buffer while the kernel writes it. Rendering only waits for the disk when all the buffers
+			* are being written.
+			*
+			* Without io_uring (kernel or headers too old, or io_uring disabled), the buffers are written with pwrite
+			* as soon as they are full. finish() waits for the pending writes, and is called by the destructor otherwise.
+			* POSIX only.
+			*/
+			class AsyncFileStreamBuf : public std::streambuf {
+			public:
+				AsyncFileStreamBuf(const std::string& fileName, std::size_t bufferCount = 8, std::size_t bufferSize = 1024 * 1024)
+						: m_fileName(fileName), m_buffers(std::max<std::size_t>(bufferCount, 1)) {
+					m_fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+					if(m_fd < 0)
+						fail("open", errno);
+					for(std::size_t i = 0; i < m_buffers.size(); ++i) {
+						m_buffers[i].data.resize(bufferSize);
+						m_free.push_back(m_buffers.size() - 1 - i);
+					}
+#ifdef AMANITE_IO_URING
+					try {
+						m_ring.reset(new Ring(static_cast<unsigned>(m_buffers.size())));
+					} catch(const std::exception&) {
+						//pwrite fallback.
+					}
+#endif
+					nextBuffer();
+				}
+
+				~AsyncFileStreamBuf() {
+					try {
+						finish();
+					} catch(...) {
+					}
+				}
+
+				AsyncFileStreamBuf(const AsyncFileStreamBuf&) = delete;
+				AsyncFileStreamBuf& operator=(const AsyncFileStreamBuf&) = delete;
+
+				/**
+				* Tell if the writes go through io_uring.
+				*/
+				bool isAsync() const {
+#ifdef AMANITE_IO_URING
+					return m_ring != nullptr;
+#else
+					return false;
+#endif
+				}
+
+				/**
+				* Write the remaining data, wait for all the writes and close the file.
+				*/
+				void finish() {
+					if(m_fd < 0)
+						return;
+					int error = 0;
+					try {
+						submitBuffer();
+						waitAll();
+					} catch(...) {
+						close(m_fd);
+						m_fd = -1;
+						throw;
+					}
+					if(close(m_fd) != 0)
+						error = errno;
+					m_fd = -1;
+					setp(nullptr, nullptr);
+					if(error != 0)
+						fail("close", error);
+				}
+
+			protected:
+				int overflow(int c) override {
+					if(m_fd < 0)
+						return traits_type::eof();
+					submitBuffer();
+					nextBuffer();
+					if(c != traits_type::eof()) {
+						*pptr() = static_cast<char>(c);
+						pbump(1);
+					}
+					return traits_type::not_eof(c);
+				}
+
+				/**
+				* Submit the current buffer and wait until everything has been written.
+				*/
+				int sync() override {
+					if(m_fd < 0)
+						return 0;
+					try {
+						submitBuffer();
+						waitAll();
+						nextBuffer();
+					} catch(const std::exception&) {
+						return -1;
+					}
+					return 0;
+				}
+
+			private:
+				struct Buffer {
+					std::vector<char> data;
+					struct iovec iov;
+					off_t offset = 0;
+					std::size_t size = 0;
+					std::size_t written = 0;
+				};
+
+				/**
+				* Submit the data of the current buffer, and release it.
+				*/
+				void submitBuffer() {
+					if(m_current == npos)
+						return;
+					Buffer& buffer = m_buffers[m_current];
+					std::size_t index = m_current;
+					m_current = npos;
+					buffer.size = static_cast<std::size_t>(pptr() - pbase());
+					buffer.written = 0;
+					buffer.offset = m_offset;
+					m_offset += static_cast<off_t>(buffer.size);
+					setp(nullptr, nullptr);
+					if(buffer.size == 0) {
+						m_free.push_back(index);
+						return;
+					}
+#ifdef AMANITE_IO_URING
+					if(m_ring != nullptr) {
+						++m_pending;
+						submitWrite(index);
+						return;
+					}
+#endif
+					while(buffer.written < buffer.size) {
+						ssize_t res = pwrite(m_fd, buffer.data.data() + buffer.written, buffer.size - buffer.written,
+								buffer.offset + static_cast<off_t>(buffer.written));
+						if(res < 0 && errno == EINTR)
+							continue;
+						if(res <= 0) {
+							m_free.push_back(index);
+							fail("pwrite", res < 0 ? errno : EIO);
+						}
+						buffer.written += static_cast<std::size_t>(res);
+					}
+					m_free.push_back(index);
+				}
+
+				/**
+				* Make a free buffer the current one, waiting for a write to complete if there is none.
+				*/
+				void nextBuffer() {
+#ifdef AMANITE_IO_URING
+					if(m_ring != nullptr) {
+						while(m_ring->hasCompletion())
+							complete();
+						while(m_free.empty())
+							complete();
+					}
+#endif
+					m_current = m_free.back();
+					m_free.pop_back();
+					Buffer& buffer = m_buffers[m_current];
+					setp(buffer.data.data(), buffer.data.data() + buffer.data.size());
+				}
+
+				void waitAll() {
+#ifdef AMANITE_IO_URING
+					while(m_pending > 0)
+						complete();
+#endif
+				}
+
+#ifdef AMANITE_IO_URING
+				/**
+				* Minimal io_uring instance, driven through the system calls directly.
+				*/
+				class Ring {
+				public:
+					explicit Ring(unsigned entries) {
+						io_uring_params params;
+						std::memset(&params, 0, sizeof(params));
+						m_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+						if(m_fd < 0)
+							throw std::runtime_error(std::string("io_uring_setup failed : ") + std::strerror(errno));
+
+						m_sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+						m_cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+						bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+						if(singleMap)
+							m_sqSize = m_cqSize = std::max(m_sqSize, m_cqSize);
+						m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+						try {
+							m_sq = map(m_sqSize, IORING_OFF_SQ_RING);
+							m_cq = singleMap ? m_sq : map(m_cqSize, IORING_OFF_CQ_RING);
+							m_sqes = static_cast<io_uring_sqe*>(map(m_sqesSize, IORING_OFF_SQES));
+						} catch(...) {
+							release();
+							throw;
+						}
+
+						m_sqTail = field<unsigned>(m_sq, params.sq_off.tail);
+						m_sqMask = *field<unsigned>(m_sq, params.sq_off.ring_mask);
+						m_sqArray = field<unsigned>(m_sq, params.sq_off.array);
+						m_cqHead = field<unsigned>(m_cq, params.cq_off.head);
+						m_cqTail = field<unsigned>(m_cq, params.cq_off.tail);
+						m_cqMask = *field<unsigned>(m_cq, params.cq_off.ring_mask);
+						m_cqes = field<io_uring_cqe>(m_cq, params.cq_off.cqes);
+					}
+
+					~Ring() {
+						release();
+					}
+
+					Ring(const Ring&) = delete;
+					Ring& operator=(const Ring&) = delete;
+
+					/**
+					* Submit the write of iov to fd at offset. The ring must have a free entry.
+					*/
+					void write(int fd, const struct iovec* iov, off_t offset, std::uint64_t userData) {
+						unsigned tail = *m_sqTail;
+						unsigned index = tail & m_sqMask;
+						io_uring_sqe& sqe = m_sqes[index];
+						std::memset(&sqe, 0, sizeof(sqe));
+						sqe.opcode = IORING_OP_WRITEV;
+						sqe.fd = fd;
+						sqe.addr = reinterpret_cast<std::uint64_t>(iov);
+						sqe.len = 1;
+						sqe.off = static_cast<std::uint64_t>(offset);
+						sqe.user_data = userData;
+						m_sqArray[index] = index;
+						__atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+						enter(1, 0, 0);
+					}
+
+					bool hasCompletion() const {
+						return *m_cqHead != __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+					}
+
+					/**
+					* Wait for the next completion.
+					*/
+					void wait(std::uint64_t& userData, int& res) {
+						while(!hasCompletion())
+							enter(0, 1, IORING_ENTER_GETEVENTS);
+						unsigned head = *m_cqHead;
+						const io_uring_cqe& cqe = m_cqes[head & m_cqMask];
+						userData = cqe.user_data;
+						res = cqe.res;
+						__atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+					}
+
+				private:
+					void release() {
+						if(m_sqes != nullptr)
+							munmap(m_sqes, m_sqesSize);
+						if(m_cq != nullptr && m_cq != m_sq)
+							munmap(m_cq, m_cqSize);
+						if(m_sq != nullptr)
+							munmap(m_sq, m_sqSize);
+						close(m_fd);
+					}
+
+					void* map(std::size_t size, off_t offset) {
+						void* res = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+						if(res == MAP_FAILED)
+							throw std::runtime_error(std::string("io_uring mmap failed : ") + std::strerror(errno));
+						return res;
+					}
+
+					template <class T>
+					static T* field(void* ring, unsigned offset) {
+						return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+					}
+
+					void enter(unsigned toSubmit, unsigned minComplete, unsigned flags) {
+						while(syscall(__NR_io_uring_enter, m_fd, toSubmit, minComplete, flags, nullptr, 0) < 0) {
+							if(errno != EINTR)
+								throw std::runtime_error(std::string("io_uring_enter failed : ") + std::strerror(errno));
+						}
+					}
+
+					int m_fd = -1;
+					void* m_sq = nullptr;
+					void* m_cq = nullptr;
+					io_uring_sqe* m_sqes = nullptr;
+					std::size_t m_sqSize = 0;
+					std::size_t m_cqSize = 0;
+					std::size_t m_sqesSize = 0;
+					unsigned* m_sqTail = nullptr;
+					unsigned m_sqMask = 0;
+					unsigned* m_sqArray = nullptr;
+					unsigned* m_cqHead = nullptr;
+					unsigned* m_cqTail = nullptr;
+					unsigned m_cqMask = 0;
+					io_uring_cqe* m_cqes = nullptr;
+				};
+
+				void submitWrite(std::size_t index) {
+					Buffer& buffer = m_buffers[index];
+					buffer.iov.iov_base = buffer.data.data() + buffer.written;
+					buffer.iov.iov_len = buffer.size - buffer.written;
+					m_ring->write(m_fd, &buffer.iov, buffer.offset + static_cast<off_t>(buffer.written), index);
+				}
+
+				/**
+				* Handle the next completion : resubmit the rest of a short write, or release the buffer.
+				*/
+				void complete() {
+					std::uint64_t index;
+					int res;
+					m_ring->wait(index, res);
+					Buffer& buffer = m_buffers[index];
+					if(res == -EINTR || res == -EAGAIN) {
+						submitWrite(index);
+						return;
+					}
+					if(res <= 0) {
+						--m_pending;
+						m_free.push_back(index);
+						fail("write", res < 0 ? -res : EIO);
+					}
+					buffer.written += static_cast<std::size_t>(res);
+					if(buffer.written < buffer.size) {
+						submitWrite(index);
+					} else {
+						--m_pending;
+						m_free.push_back(index);
+					}
+				}
+
+				std::unique_ptr<Ring> m_ring;
+				std::size_t m_pending = 0;
+#endif
+
+				void fail(const char* call, int error) {
+					throw std::runtime_error(std::string(call) + " failed on " + m_fileName + " : " + std::strerror(error));
+				}
+
+				static const std::size_t npos = static_cast<std::size_t>(-1);
+
+				std::string m_fileName;
+				int m_fd = -1;
+				std::vector<Buffer> m_buffers;
+				std::vector<std::size_t> m_free;
+				std::size_t m_current = npos;
+				//offset of the next buffer in the file.
+				off_t m_offset = 0;
+			};
+		}
+	}
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <string>
+#include <streambuf>
+#include <stdexcept>
+#include <algorithm>
+#include <limits>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace amanite {
+	namespace template_engine {
+		namespace sink {
+
+			/**
+			* Stream buffer writing a file through a memory mapping : the output is written directly to the page cache,
+			* without a system call per buffer.
+			*
+			* The file grows by extents of extentSize bytes, allocated with fallocate on Linux so that the blocks are
+			* reserved before they are written. Each extent is mapped in turn. finish() truncates the file to the size
+			* of the output, and is called by the destructor otherwise. POSIX only.
+			*/
+			class MappedFileStreamBuf : public std::streambuf {
+			public:
+				MappedFileStreamBuf(const std::string& fileName, std::size_t extentSize = 64 * 1024 * 1024)
+						: m_fileName(fileName) {
+					long pageSize = sysconf(_SC_PAGESIZE);
+					//extents are mapped at offsets that are multiples of their size.
+					m_extentSize = (extentSize + pageSize - 1) / pageSize * pageSize;
+					m_fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+					if(m_fd < 0)
+						fail("open");
+					try {
+						mapExtent(0);
+					} catch(...) {
+						close(m_fd);
+						throw;
+					}
+				}
+
+				~MappedFileStreamBuf() {
+					try {
+						finish();
+					} catch(...) {
+					}
+				}
+
+				MappedFileStreamBuf(const MappedFileStreamBuf&) = delete;
+				MappedFileStreamBuf& operator=(const MappedFileStreamBuf&) = delete;
+
+				/**
+				* Unmap the file and truncate it to the size of the output.
+				*/
+				void finish() {
+					if(m_fd < 0)
+						return;
+					off_t size = m_offset + (pptr() - pbase());
+					unmapExtent();
+					m_offset = size;
+					int fd = m_fd;
+					m_fd = -1;
+					bool truncated = ftruncate(fd, size) == 0;
+					int error = errno;
+					close(fd);
+					if(!truncated) {
+						errno = error;
+						fail("ftruncate");
+					}
+				}
+
+				/**
+				* Number of bytes written so far.
+				*/
+				std::size_t size() const {
+					return static_cast<std::size_t>(m_offset + (pptr() - pbase()));
+				}
+
+			protected:
+				int overflow(int c) override {
+					if(m_fd < 0)
+						return traits_type::eof();
+					off_t next = m_offset + static_cast<off_t>(m_extentSize);
+					unmapExtent();
+					mapExtent(next);
+					if(c != traits_type::eof()) {
+						*pptr() = static_cast<char>(c);
+						pbump(1);
+					}
+					return traits_type::not_eof(c);
+				}
+
+				std::streamsize xsputn(const char* s, std::streamsize n) override {
+					std::streamsize written = 0;
+					while(written < n) {
+						if(pptr() == epptr() && overflow(traits_type::eof()) == traits_type::eof())
+							break;
+						std::streamsize size = std::min<std::streamsize>({n - written, epptr() - pptr(), std::numeric_limits<int>::max()});
+						std::memcpy(pptr(), s + written, static_cast<std::size_t>(size));
+						pbump(static_cast<int>(size));
+						written += size;
+					}
+					return written;
+				}
+
+			private:
+				void mapExtent(off_t offset) {
+					off_t end = offset + static_cast<off_t>(m_extentSize);
+#ifdef __linux__
+					//filesystems without fallocate get a sparse file.
+					if(fallocate(m_fd, 0, offset, static_cast<off_t>(m_extentSize)) != 0
+							&& errno != EOPNOTSUPP && errno != ENOSYS)
+						fail("fallocate");
+#endif
+					struct stat st;
+					if(fstat(m_fd, &st) != 0)
+						fail("fstat");
+					if(st.st_size < end && ftruncate(m_fd, end) != 0)
+						fail("ftruncate");
+
+					void* data = mmap(nullptr, m_extentSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, offset);
+					if(data == MAP_FAILED)
+						fail("mmap");
+					m_data = static_cast<char*>(data);
+					m_offset = offset;
+					setp(m_data, m_data + m_extentSize);
+				}
+
+				void unmapExtent() {
+					if(m_data == nullptr)
+						return;
+					munmap(m_data, m_extentSize);
+					m_data = nullptr;
+					setp(nullptr, nullptr);
+				}
+
+				void fail(const char* call) {
+					throw std::runtime_error(std::string(call) + " failed on " + m_fileName + " : " + std::strerror(errno));
+				}
+
+				std::string m_fileName;
+				std::size_t m_extentSize;
+				int m_fd = -1;
+				char* m_data = nullptr;
+				//offset of the mapped extent in the file.
+				off_t m_offset = 0;
+			};
+		}
+	}
+}
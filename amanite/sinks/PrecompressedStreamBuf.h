@@ -0,0 +1,296 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <ostream>
+#include <stdexcept>
+#include <algorithm>
+
+#include <zlib.h>
+
+#include "amanite/template_engine/CompiledTemplate.h"
+#include "amanite/template_engine/StaticTextSink.h"
+#include "amanite/template_engine/Node.h"
+#include "ZlibStreamBuf.h"
+
+namespace amanite {
+	namespace template_engine {
+		namespace sink {
+
+			/**
+			* Text nodes of a template compressed once, each of them as an independent piece of raw deflate data.
+			*
+			* A fragment does not refer to data preceding it and ends on a byte boundary, without ending the
+			* compressed data, so that it can be copied as is between other deflate data. The template must outlive
+			* the fragments, since they are found by the address of their node.
+			*/
+			class CompressedFragments {
+			public:
+				struct Configuration {
+					Configuration() :
+							level(Z_BEST_COMPRESSION),
+							minFragmentSize(256),
+							maxStoredSize(1024) {
+
+					}
+
+					int level;
+					//shorter text nodes are compressed with the dynamic output : an independent fragment costs a few bytes.
+					std::size_t minFragmentSize;
+					//dynamic output of at most maxStoredSize bytes between two fragments is written without compression,
+					//which is cheaper than the full flush compressing it requires.
+					std::size_t maxStoredSize;
+				};
+
+				struct Fragment {
+					std::string data;
+					uLong crc32;
+					uLong adler32;
+					uLong length;
+				};
+
+				CompressedFragments(const CompiledTemplate& tmpl, const Configuration& configuration = Configuration())
+						: m_configuration(configuration) {
+					add(tmpl.getNodes());
+					for(const auto& dep : tmpl.getDeps())
+						add(*dep.second);
+				}
+
+				const Configuration& getConfiguration() const {
+					return m_configuration;
+				}
+
+				/**
+				* Fragment of node, or nullptr if its text is not compressed.
+				*/
+				const Fragment* find(const Node& node) const {
+					auto fragment = m_fragments.find(&node);
+					return fragment != m_fragments.end() ? &fragment->second : nullptr;
+				}
+
+				std::size_t size() const {
+					return m_fragments.size();
+				}
+
+			private:
+				void add(const std::list<Node>& nodes) {
+					for(const Node& node : nodes) {
+						if(node.type == Node::Type::text && node.value.size() >= m_configuration.minFragmentSize
+								&& m_fragments.find(&node) == m_fragments.end())
+							m_fragments.emplace(&node, compress(node.value));
+						add(node.children);
+					}
+				}
+
+				Fragment compress(const std::string& text) const {
+					z_stream stream;
+					stream.zalloc = Z_NULL;
+					stream.zfree = Z_NULL;
+					stream.opaque = Z_NULL;
+					if(deflateInit2(&stream, m_configuration.level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+						throw std::runtime_error("zlib initialization failed");
+
+					Fragment res;
+					res.data.resize(deflateBound(&stream, text.size()) + 16);
+					stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(text.data()));
+					stream.avail_in = static_cast<uInt>(text.size());
+					stream.next_out = reinterpret_cast<Bytef*>(&res.data[0]);
+					stream.avail_out = static_cast<uInt>(res.data.size());
+					//the sync flush ends the fragment on a byte boundary, without a final block.
+					int status = deflate(&stream, Z_SYNC_FLUSH);
+					res.data.resize(res.data.size() - stream.avail_out);
+					deflateEnd(&stream);
+					if(status != Z_OK || stream.avail_in != 0)
+						throw std::runtime_error("zlib compression failed");
+
+					const Bytef* bytes = reinterpret_cast<const Bytef*>(text.data());
+					res.crc32 = ::crc32(::crc32(0L, Z_NULL, 0), bytes, static_cast<uInt>(text.size()));
+					res.adler32 = ::adler32(::adler32(0L, Z_NULL, 0), bytes, static_cast<uInt>(text.size()));
+					res.length = static_cast<uLong>(text.size());
+					return res;
+				}
+
+				Configuration m_configuration;
+				std::unordered_map<const Node*, Fragment> m_fragments;
+			};
+
+			/**
+			* Stream buffer producing compressed data in which the text nodes found in fragments are copied from their
+			* precompressed form, and only the rest of the output is compressed while rendering.
+			*
+			* The rest of the output is compressed as a single deflate stream, flushed with Z_FULL_FLUSH before each
+			* fragment, so that it does not refer to data written before the fragment. Short output between two fragments
+			* is written in stored blocks instead. The checksums of the fragments are combined with the checksum of the output.
+			*
+			* Since the fragments can not refer to each other, the result is larger than with ZlibStreamBuf : the sink
+			* trades size for speed, and suits templates made of large static blocks.
+			* finish() has to be called to complete the compressed data, and is called by the destructor otherwise.
+			*/
+			class PrecompressedStreamBuf : public StaticTextSink {
+			public:
+				PrecompressedStreamBuf(std::ostream& out, const CompressedFragments& fragments, ZlibFormat format = ZlibFormat::GZIP,
+						int level = Z_DEFAULT_COMPRESSION, std::size_t bufferSize = 16384)
+						: m_out(out), m_fragments(fragments), m_format(format), m_input(bufferSize), m_output(bufferSize) {
+					m_stream.zalloc = Z_NULL;
+					m_stream.zfree = Z_NULL;
+					m_stream.opaque = Z_NULL;
+					if(deflateInit2(&m_stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+						throw std::runtime_error("zlib initialization failed");
+					m_crc32 = ::crc32(0L, Z_NULL, 0);
+					m_adler32 = ::adler32(0L, Z_NULL, 0);
+					setp(m_input.data(), m_input.data() + m_input.size());
+					writeHeader();
+				}
+
+				~PrecompressedStreamBuf() {
+					try {
+						finish();
+					} catch(...) {
+					}
+					deflateEnd(&m_stream);
+				}
+
+				PrecompressedStreamBuf(const PrecompressedStreamBuf&) = delete;
+				PrecompressedStreamBuf& operator=(const PrecompressedStreamBuf&) = delete;
+
+				void writeText(const Node& node) override {
+					const CompressedFragments::Fragment* fragment = m_fragments.find(node);
+					if(fragment == nullptr) {
+						xsputn(node.value.data(), static_cast<std::streamsize>(node.value.size()));
+						return;
+					}
+
+					std::size_t pending = static_cast<std::size_t>(pptr() - pbase());
+					if(m_dirty || pending > m_fragments.getConfiguration().maxStoredSize)
+						compress(Z_FULL_FLUSH);
+					else if(pending > 0)
+						store();
+					m_out.write(fragment->data.data(), fragment->data.size());
+					m_crc32 = crc32_combine(m_crc32, fragment->crc32, fragment->length);
+					m_adler32 = adler32_combine(m_adler32, fragment->adler32, fragment->length);
+					m_length += fragment->length;
+				}
+
+				/**
+				* Compress the remaining data and write the end of the compressed data.
+				*/
+				void finish() {
+					if(m_finished)
+						return;
+					compress(Z_FINISH);
+					writeTrailer();
+					m_finished = true;
+					m_out.flush();
+				}
+
+			protected:
+				int overflow(int c) override {
+					if(m_finished)
+						return traits_type::eof();
+					compress(Z_NO_FLUSH);
+					if(c != traits_type::eof()) {
+						*pptr() = static_cast<char>(c);
+						pbump(1);
+					}
+					return traits_type::not_eof(c);
+				}
+
+				int sync() override {
+					if(m_finished)
+						return 0;
+					compress(Z_SYNC_FLUSH);
+					m_out.flush();
+					return m_out ? 0 : -1;
+				}
+
+			private:
+				void compress(int flush) {
+					const Bytef* input = reinterpret_cast<const Bytef*>(pbase());
+					uInt inputSize = static_cast<uInt>(pptr() - pbase());
+					m_crc32 = ::crc32(m_crc32, input, inputSize);
+					m_adler32 = ::adler32(m_adler32, input, inputSize);
+					m_length += inputSize;
+
+					m_stream.next_in = const_cast<Bytef*>(input);
+					m_stream.avail_in = inputSize;
+					int res;
+					do {
+						m_stream.next_out = reinterpret_cast<Bytef*>(m_output.data());
+						m_stream.avail_out = static_cast<uInt>(m_output.size());
+						res = deflate(&m_stream, flush);
+						if(res == Z_STREAM_ERROR)
+							throw std::runtime_error("zlib compression failed");
+						m_out.write(m_output.data(), m_output.size() - m_stream.avail_out);
+					} while(m_stream.avail_out == 0 || (flush == Z_FINISH && res != Z_STREAM_END));
+					if(flush == Z_FULL_FLUSH)
+						m_dirty = false;
+					else if(inputSize > 0)
+						m_dirty = true;
+					setp(m_input.data(), m_input.data() + m_input.size());
+				}
+
+				/**
+				* Write the pending output as a stored block. It follows a fragment or a full flush, so it starts on
+				* a byte boundary.
+				*/
+				void store() {
+					const Bytef* input = reinterpret_cast<const Bytef*>(pbase());
+					uInt inputSize = static_cast<uInt>(pptr() - pbase());
+					m_crc32 = ::crc32(m_crc32, input, inputSize);
+					m_adler32 = ::adler32(m_adler32, input, inputSize);
+					m_length += inputSize;
+
+					for(uInt offset = 0; offset < inputSize; offset += 0xFFFF) {
+						unsigned length = std::min<uInt>(inputSize - offset, 0xFFFF);
+						//BFINAL = 0, BTYPE = 00, then LEN and NLEN.
+						char header[] = {0, static_cast<char>(length & 0xFF), static_cast<char>(length >> 8),
+								static_cast<char>(~length & 0xFF), static_cast<char>((~length >> 8) & 0xFF)};
+						m_out.write(header, sizeof(header));
+						m_out.write(pbase() + offset, length);
+					}
+					setp(m_input.data(), m_input.data() + m_input.size());
+				}
+
+				void writeHeader() {
+					if(m_format == ZlibFormat::GZIP) {
+						static const char header[] = {'\x1f', '\x8b', '\x08', 0, 0, 0, 0, 0, 0, '\xff'};
+						m_out.write(header, sizeof(header));
+					} else if(m_format == ZlibFormat::ZLIB) {
+						m_out.write("\x78\x9c", 2);
+					}
+				}
+
+				void writeTrailer() {
+					if(m_format == ZlibFormat::GZIP) {
+						writeInteger(m_crc32, false);
+						writeInteger(m_length & 0xFFFFFFFFu, false);
+					} else if(m_format == ZlibFormat::ZLIB) {
+						writeInteger(m_adler32, true);
+					}
+				}
+
+				void writeInteger(uLong value, bool bigEndian) {
+					char bytes[4];
+					for(int i = 0; i < 4; ++i)
+						bytes[bigEndian ? 3 - i : i] = static_cast<char>((value >> (8 * i)) & 0xFF);
+					m_out.write(bytes, 4);
+				}
+
+				std::ostream& m_out;
+				const CompressedFragments& m_fragments;
+				ZlibFormat m_format;
+				z_stream m_stream;
+				std::vector<char> m_input;
+				std::vector<char> m_output;
+				uLong m_crc32;
+				uLong m_adler32;
+				unsigned long long m_length = 0;
+				//data has been compressed since the last full flush, so that the next data may refer to it.
+				bool m_dirty = false;
+				bool m_finished = false;
+			};
+		}
+	}
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <streambuf>
+#include <stdexcept>
+
+#include <zlib.h>
+
+namespace amanite {
+	namespace template_engine {
+		namespace sink {
+
+			/**
+			* Container of the compressed data : raw deflate data, zlib stream (RFC 1950) or gzip file (RFC 1952).
+			*/
+			enum class ZlibFormat {
+				DEFLATE, ZLIB, GZIP
+			};
+
+			/**
+			* Stream buffer compressing what is written to it into another stream, as it is rendered.
+			* finish() has to be called to complete the compressed data, and is called by the destructor otherwise.
+			*/
+			class ZlibStreamBuf : public std::streambuf {
+			public:
+				ZlibStreamBuf(std::ostream& out, ZlibFormat format = ZlibFormat::GZIP, int level = Z_DEFAULT_COMPRESSION, std::size_t bufferSize = 16384)
+						: m_out(out), m_input(bufferSize), m_output(bufferSize) {
+					m_stream.zalloc = Z_NULL;
+					m_stream.zfree = Z_NULL;
+					m_stream.opaque = Z_NULL;
+					int windowBits = format == ZlibFormat::DEFLATE ? -15 : format == ZlibFormat::GZIP ? 15 + 16 : 15;
+					if(deflateInit2(&m_stream, level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+						throw std::runtime_error("zlib initialization failed");
+					setp(m_input.data(), m_input.data() + m_input.size());
+				}
+
+				~ZlibStreamBuf() {
+					try {
+						finish();
+					} catch(...) {
+					}
+					deflateEnd(&m_stream);
+				}
+
+				ZlibStreamBuf(const ZlibStreamBuf&) = delete;
+				ZlibStreamBuf& operator=(const ZlibStreamBuf&) = delete;
+
+				/**
+				* Compress the remaining data and write the end of the compressed data.
+				*/
+				void finish() {
+					if(m_finished)
+						return;
+					compress(Z_FINISH);
+					m_finished = true;
+					m_out.flush();
+				}
+
+			protected:
+				int overflow(int c) override {
+					if(m_finished)
+						return traits_type::eof();
+					compress(Z_NO_FLUSH);
+					if(c != traits_type::eof()) {
+						*pptr() = static_cast<char>(c);
+						pbump(1);
+					}
+					return traits_type::not_eof(c);
+				}
+
+				/**
+				* Flushing the stream sends the data compressed so far, at the cost of a few bytes.
+				*/
+				int sync() override {
+					if(m_finished)
+						return 0;
+					compress(Z_SYNC_FLUSH);
+					m_out.flush();
+					return m_out ? 0 : -1;
+				}
+
+			private:
+				void compress(int flush) {
+					m_stream.next_in = reinterpret_cast<Bytef*>(pbase());
+					m_stream.avail_in = static_cast<uInt>(pptr() - pbase());
+					int res;
+					do {
+						m_stream.next_out = reinterpret_cast<Bytef*>(m_output.data());
+						m_stream.avail_out = static_cast<uInt>(m_output.size());
+						res = deflate(&m_stream, flush);
+						if(res == Z_STREAM_ERROR)
+							throw std::runtime_error("zlib compression failed");
+						m_out.write(m_output.data(), m_output.size() - m_stream.avail_out);
+					} while(m_stream.avail_out == 0 || (flush == Z_FINISH && res != Z_STREAM_END));
+					setp(m_input.data(), m_input.data() + m_input.size());
+				}
+
+				std::ostream& m_out;
+				z_stream m_stream;
+				std::vector<char> m_input;
+				std::vector<char> m_output;
+				bool m_finished = false;
+			};
+		}
+	}
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <sstream>
+#include <iterator>
+#include <algorithm>
+
+#include "CompiledTemplate.h"
+#include "Renderer.h"
+#include "amanite/tools/ThreadPool.h"
+
+namespace amanite {
+	namespace template_engine {
+
+		/**
+		* Render one template against many contexts, either into one string per context or into a single stream,
+		* keeping the order of the contexts.
+		*
+		* The contexts are rendered by windows : a window is split into chunks handed to the workers, then its outputs
+		* are written in order, so the memory used for a concatenated output does not depend on the number of contexts.
+		* Each worker has its own Renderer, kept between batches. The contexts must not share adapters, since adapters
+		* are not thread safe.
+		*
+		* The values of the range are either contexts, or values a context can be built from (e.g. json11::Json for
+		* JsonContextAdapter, so that the result of json11::Json::parse_multi can be given directly).
+		*/
+		template <class Context>
+		class BatchRenderer {
+		public:
+			struct Configuration {
+				//1 renders in the calling thread.
+				std::size_t threadCount = 1;
+				//number of consecutive contexts taken by a worker at once.
+				std::size_t chunkSize = 16;
+				//number of contexts rendered before the outputs are written.
+				std::size_t windowSize = 1024;
+			};
+
+			BatchRenderer(const Configuration& configuration = Configuration()) : m_configuration(configuration) {
+				std::size_t workerCount = std::max<std::size_t>(m_configuration.threadCount, 1);
+				for(std::size_t i = 0; i < workerCount; ++i) {
+					m_renderers.emplace_back(new Renderer<Context>());
+					m_streams.emplace_back(new std::ostringstream());
+				}
+				if(workerCount > 1)
+					m_pool.reset(new tools::ThreadPool(workerCount));
+			}
+
+			const Configuration& getConfiguration() const {
+				return m_configuration;
+			}
+
+			std::size_t getWorkerCount() const {
+				return m_renderers.size();
+			}
+
+			/**
+			* Renderer of a worker, to be configured (fragment cache, scripts...) before rendering.
+			*/
+			Renderer<Context>& getRenderer(std::size_t worker) {
+				return *m_renderers[worker];
+			}
+
+			template<class Iterator>
+			std::vector<std::string> render(Iterator first, Iterator last, const CompiledTemplate& tmpl) {
+				std::vector<std::string> res;
+				renderAll(first, last, tmpl, [&](std::string& output) {
+					res.push_back(std::move(output));
+				});
+				return res;
+			}
+
+			template<class Range>
+			std::vector<std::string> render(const Range& contexts, const CompiledTemplate& tmpl) {
+				return render(std::begin(contexts), std::end(contexts), tmpl);
+			}
+
+			template<class Iterator>
+			void render(Iterator first, Iterator last, const CompiledTemplate& tmpl, std::ostream& os) {
+				renderAll(first, last, tmpl, [&](std::string& output) {
+					os << output;
+				});
+			}
+
+			template<class Range>
+			void render(const Range& contexts, const CompiledTemplate& tmpl, std::ostream& os) {
+				render(std::begin(contexts), std::end(contexts), tmpl, os);
+			}
+
+		private:
+			template<class Iterator, class Output>
+			void renderAll(Iterator first, Iterator last, const CompiledTemplate& tmpl, Output output) {
+				//the per template setup : contexts are only bound to the script engine if the template uses it.
+				bool scriptBinding = tmpl.hasCode();
+				for(auto& renderer : m_renderers)
+					renderer->setScriptBinding(scriptBinding);
+
+				std::size_t windowSize = std::max<std::size_t>(m_configuration.windowSize, 1);
+				std::vector<Iterator> window;
+				std::vector<std::string> outputs;
+				while(first != last) {
+					window.clear();
+					for(; first != last && window.size() < windowSize; ++first)
+						window.push_back(first);
+					outputs.resize(window.size());
+
+					renderWindow(window, outputs, tmpl);
+					for(std::size_t i = 0; i < window.size(); ++i)
+						output(outputs[i]);
+				}
+			}
+
+			template<class Iterator>
+			void renderWindow(const std::vector<Iterator>& window, std::vector<std::string>& outputs, const CompiledTemplate& tmpl) {
+				if(m_pool == nullptr) {
+					for(std::size_t i = 0; i < window.size(); ++i)
+						renderOne(0, *window[i], outputs[i], tmpl);
+					return;
+				}
+
+				std::size_t chunkSize = std::max<std::size_t>(m_configuration.chunkSize, 1);
+				std::atomic<std::size_t> next(0);
+				m_pool->run([&](std::size_t worker) {
+					for(std::size_t start = next.fetch_add(chunkSize); start < window.size(); start = next.fetch_add(chunkSize)) {
+						std::size_t end = std::min(start + chunkSize, window.size());
+						for(std::size_t i = start; i < end; ++i)
+							renderOne(worker, *window[i], outputs[i], tmpl);
+					}
+				});
+			}
+
+			void renderOne(std::size_t worker, const Context& c, std::string& output, const CompiledTemplate& tmpl) {
+				std::ostringstream& os = *m_streams[worker];
+				os.str(std::string());
+				m_renderers[worker]->render(c, os, tmpl);
+				output = os.str();
+			}
+
+			template<class Value>
+			void renderOne(std::size_t worker, const Value& value, std::string& output, const CompiledTemplate& tmpl) {
+				Context c(value);
+				renderOne(worker, c, output, tmpl);
+			}
+
+			Configuration m_configuration;
+			std::vector<std::unique_ptr<Renderer<Context>>> m_renderers;
+			std::vector<std::unique_ptr<std::ostringstream>> m_streams;
+			std::unique_ptr<tools::ThreadPool> m_pool;
+		};
+	}
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+
+namespace amanite {
+	namespace template_engine {
+
+		/**
+		* Deadline and cancellation flag of renders (see Renderer::setCancellation). The renderer checks them
+		* between the items of the sections, before the partials and around the code nodes, and stops with a
+		* RenderCancelled exception. cancel() may be called from any thread, the deadline is set before the render.
+		*/
+		class Cancellation {
+		public:
+			typedef std::chrono::steady_clock Clock;
+
+			Cancellation() : m_deadline(Clock::time_point::max()), m_cancelled(false) {
+			}
+
+			explicit Cancellation(Clock::time_point deadline) : m_deadline(deadline), m_cancelled(false) {
+			}
+
+			Cancellation(const Cancellation&) = delete;
+			Cancellation& operator=(const Cancellation&) = delete;
+
+			void setDeadline(Clock::time_point deadline) {
+				m_deadline = deadline;
+			}
+
+			void setTimeout(Clock::duration timeout) {
+				m_deadline = Clock::now() + timeout;
+			}
+
+			Clock::time_point getDeadline() const {
+				return m_deadline;
+			}
+
+			void cancel() {
+				m_cancelled.store(true, std::memory_order_relaxed);
+			}
+
+			/**
+			* Clear the flag and the deadline, so that the cancellation can be used for another render.
+			*/
+			void reset() {
+				m_deadline = Clock::time_point::max();
+				m_cancelled.store(false, std::memory_order_relaxed);
+			}
+
+			/**
+			* Reason the renders have to stop, or nullptr if they can go on.
+			*/
+			const char* check() const {
+				if(m_cancelled.load(std::memory_order_relaxed))
+					return "cancelled";
+				if(m_deadline != Clock::time_point::max() && Clock::now() >= m_deadline)
+					return "deadline exceeded";
+				return nullptr;
+			}
+
+		private:
+			Clock::time_point m_deadline;
+			std::atomic<bool> m_cancelled;
+		};
+
+		/**
+		* Thrown by a cancelled render. The output stream holds the output of the nodes rendered before : a prefix
+		* of the full output, ending between two nodes. The output of an unfinished cached section is neither
+		* written nor cached.
+		*/
+		class RenderCancelled : public std::runtime_error {
+		public:
+			RenderCancelled(const std::string& reason) : std::runtime_error("Render stopped : " + reason) {
+			}
+
+			/**
+			* Where the render stopped : the sections, items and partials it was in, outermost first, then the
+			* node it was about to run. E.g. "items[1532] > partial row > code".
+			*/
+			const std::string& getLocation() const {
+				return m_location;
+			}
+
+			/**
+			* Prepend step to the location, while the exception goes up the nodes. An item index ("[i]") is
+			* appended to the name of its section.
+			*/
+			void enter(const std::string& step) {
+				if(!m_location.empty() && m_location[0] != '[')
+					m_location = " > " + m_location;
+				m_location = step + m_location;
+			}
+
+		private:
+			std::string m_location;
+		};
+	}
+}
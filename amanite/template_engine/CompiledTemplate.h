@@ -6,13 +6,36 @@
 #include <list>
 #include <map>
 #include <deque>
+#include <memory>
+#include <vector>
 
 namespace amanite {
 	namespace template_engine {
 
+		/**
+		* Compiled partials are immutable, and shared by all the templates that use them.
+		*/
+		typedef std::shared_ptr<const std::list<Node>> SharedNodes;
+		typedef std::map<std::string, SharedNodes> Dependencies;
+
+		/**
+		* Indices of the partial names of a compiler, given to its partial nodes (see Node::partialIndex), so that
+		* the partials shared by its templates have the same index in all of them.
+		*/
+		class PartialIndices {
+		public:
+			int get(const std::string& name) {
+				return m_indices.emplace(name, static_cast<int>(m_indices.size())).first->second;
+			}
+
+		private:
+			std::map<std::string, int> m_indices;
+		};
+
 		class CompiledTemplate {
 			std::list <Node> m_nodes;
-			std::map <std::string, std::list<Node>> m_deps;
+			Dependencies m_deps;
+			std::vector<SharedNodes> m_partials;
 
 		public:
 
@@ -24,13 +47,51 @@ namespace amanite {
 			}
 
 
-			std::map <std::string, std::list<Node>>& getDeps(){
+			Dependencies& getDeps(){
 				return m_deps;
 			}
-			const std::map <std::string, std::list<Node>>& getDeps() const{
+			const Dependencies& getDeps() const{
 				return m_deps;
 			}
 
+			/**
+			* Partials of a linked template, indexed by Node::partialIndex (see Linker). Empty if the template is not
+			* linked. They are the shared partials of the dependencies, only the table belongs to the template.
+			*/
+			std::vector<SharedNodes>& getPartials(){
+				return m_partials;
+			}
+			const std::vector<SharedNodes>& getPartials() const{
+				return m_partials;
+			}
+
+			/**
+			* Drop the links, so that the partials are looked up by name. To be called when the dependencies are
+			* changed after the template has been linked.
+			*/
+			void unlink(){
+				m_partials.clear();
+			}
+
+			/**
+			* Tell if the template or one of its partials contains code nodes.
+			*/
+			bool hasCode() const{
+				if(hasCode(m_nodes))
+					return true;
+				for(const auto& dep : m_deps)
+					if(hasCode(*dep.second))
+						return true;
+				return false;
+			}
+
+		private:
+			static bool hasCode(const std::list<Node>& nodes){
+				for(const Node& node : nodes)
+					if(node.type == Node::Type::code || hasCode(node.children))
+						return true;
+				return false;
+			}
 
 		};
 	}
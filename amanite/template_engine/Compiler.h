@@ -2,20 +2,24 @@
 
 #include <string>
 #include <list>
+#include <set>
 #include <stack>
 #include <map>
+#include <vector>
 #include <istream>
 #include <fstream>
 #include <sstream>
 
 
 #include <boost/filesystem.hpp>
-#include <chaiscript/utility/utility.hpp>
-#include "scriptEngine.h"
 #include "amanite/tools/StringUtils.h"
 
 #include "CompiledTemplate.h"
+#include "Expression.h"
+#include "Filter.h"
+#include "HtmlMinifier.h"
 #include "Node.h"
+#include "Schema.h"
 
 namespace amanite {
 	namespace template_engine {
@@ -36,7 +40,10 @@ namespace amanite {
 						partialNodeStartTag(">"),
 						localPartialNodeStartTag("<"),
 						scriptNodeStartTag("="),
-						commentNodeStartTag("!") {
+						commentNodeStartTag("!"),
+						conditionNodeStartTag("?"),
+						expressionNodeStartTag("%"),
+						minifyHtml(false) {
 
 				}
 
@@ -50,6 +57,14 @@ namespace amanite {
 				std::string localPartialNodeStartTag;
 				std::string scriptNodeStartTag;
 				std::string commentNodeStartTag;
+				//sections rendered if an expression is true, and expressions rendered as variables (see expression::Parser).
+				std::string conditionNodeStartTag;
+				std::string expressionNodeStartTag;
+				//remove the insignificant whitespace and the comments of the HTML text (see HtmlMinifier).
+				bool minifyHtml;
+				//type of the root context. The section and var nodes of the templates compiled with compile() are
+				//specialized for the types it declares, the partials are not.
+				std::shared_ptr<const schema::Type> schema;
 			};
 
 			Configuration m_configuration;
@@ -65,33 +80,80 @@ namespace amanite {
 
 		private:
 
-			std::map<std::string, std::list<Node>> m_compiledTemplates;
+			Dependencies m_compiledTemplates;
 			std::set<std::string> m_compilingTemplates;
+			PartialIndices m_partialIndices;
+			//kept from a template to the next, so that the minified partials are shared too.
+			HtmlMinifier m_minifier{&m_partialIndices};
 
+			filter::Registry m_filters;
 
-			script::ScriptEngine m_scriptingEngine;
+			//types of the contexts of the renderer frames at the current node, as far as the schema tells them.
+			//Empty when they are not known.
+			std::vector<const schema::Type*> m_schemaFrames;
 
 		public:
+			Compiler() = default;
+
+			//the minifier refers to the partial indices of the compiler.
+			Compiler(const Compiler&) = delete;
+			Compiler& operator=(const Compiler&) = delete;
+
+			/**
+			* Filters available to the templates compiled afterwards.
+			*/
+			filter::Registry& getFilters() {
+				return m_filters;
+			}
 
 			CompiledTemplate compile(const std::string& fileName) {
 				CompiledTemplate res;
-				res.getNodes() = internalCompile(fileName);
+				SchemaScope scope(*this, getConfiguration().schema.get());
+				res.getNodes() = *internalCompile(fileName);
+				//only the pointers are copied, the compiled partials are shared.
 				res.getDeps() = m_compiledTemplates;
+				if(getConfiguration().minifyHtml)
+					m_minifier.minify(res);
 				return res;
 			}
 
 			CompiledTemplate compile(std::istream& is) {
 				CompiledTemplate res;
+				SchemaScope scope(*this, getConfiguration().schema.get());
 				res.getNodes() = internalCompile(is);
+				//only the pointers are copied, the compiled partials are shared.
 				res.getDeps() = m_compiledTemplates;
+				if(getConfiguration().minifyHtml)
+					m_minifier.minify(res);
 				return res;
 			}
 
 		private:
+			/**
+			* Track the types of the schema from root while it lives, then restore the frames of the including
+			* template. A partial is compiled without root, since it may be rendered in any context.
+			*/
+			class SchemaScope {
+			public:
+				SchemaScope(Compiler& compiler, const schema::Type* root) : m_compiler(compiler) {
+					m_frames.swap(m_compiler.m_schemaFrames);
+					if(root != nullptr)
+						m_compiler.m_schemaFrames.push_back(root);
+				}
+
+				~SchemaScope() {
+					m_frames.swap(m_compiler.m_schemaFrames);
+				}
+
+			private:
+				Compiler& m_compiler;
+				std::vector<const schema::Type*> m_frames;
+			};
+
 			/**
 			* Compilation of a file
 			*/
-			std::list<Node> internalCompile(const std::string& fileName) {
+			SharedNodes internalCompile(const std::string& fileName) {
 				using namespace boost::filesystem;
 				path p = getConfiguration().templatePath;
 				p.append(fileName.begin(), fileName.end());
@@ -104,7 +166,7 @@ namespace amanite {
 				ifs.open(p.string());
 				if(m_compilingTemplates.find(fileName) == m_compilingTemplates.end()) {
 					m_compilingTemplates.insert(fileName);
-					m_compiledTemplates[fileName] = internalCompile(ifs);
+					m_compiledTemplates[fileName] = std::make_shared<const std::list<Node>>(internalCompile(ifs));
 					m_compilingTemplates.erase(m_compilingTemplates.find(fileName));
 				}
 				return m_compiledTemplates[fileName];
@@ -137,6 +199,10 @@ namespace amanite {
 							res.push_back(compileScriptNode(node, is));
 						} else if(tools::startsWith(node, config.commentNodeStartTag)) {
 							//comment. Nothing to do
+						} else if(tools::startsWith(node, config.conditionNodeStartTag)) {
+							res.push_back(compileConditionNode(node, is));
+						} else if(tools::startsWith(node, config.expressionNodeStartTag)) {
+							res.push_back(compileExpressionNode(node, is));
 						} else {
 							res.splice(res.end(), compileVariableNode(node, is));
 						}
@@ -230,13 +296,14 @@ namespace amanite {
 				std::list<Node> res;
 				std::list<Node>* currentNodeList = &res;
 				int currentContextOffset = 0;
+				std::vector<const schema::Type*> schemaFrames = m_schemaFrames;
 				for(auto sec : sections) {
 					if(sec.compare("parent") == 0) {
-						if(currentContextOffset > 0)
-							tags.pop_back();
-						tags.push_back("contextOffset=" + std::to_string(++currentContextOffset));
+						++currentContextOffset;
 					} else {
 						currentNodeList->push_back({Node::Type::section, sec, tags});
+						currentNodeList->front().contextOffset = currentContextOffset;
+						currentNodeList->front().valueType = enterSchemaSection(currentContextOffset, sec);
 						currentNodeList->push_back({Node::Type::endScope, sec});
 						currentNodeList = &(currentNodeList->front().children);
 					}
@@ -244,6 +311,7 @@ namespace amanite {
 
 				//compile the stream until the end of section tag has been found
 				*currentNodeList = internalCompile(is, sections.back());
+				m_schemaFrames.swap(schemaFrames);
 
 				//The last node is the "endScope" node. It should be at the same level as the "section" node.
 				currentNodeList->pop_back();
@@ -281,10 +349,13 @@ namespace amanite {
 				//partial defined in the file named as "key"
 				if(m_compiledTemplates.find(key) == m_compiledTemplates.end()
 						&& m_compilingTemplates.find(key) == m_compilingTemplates.end()) {
-					compile(key);
+					SchemaScope scope(*this, nullptr);
+					internalCompile(key);
 				}
 
-				return {Node::Type::partial, key, tags};
+				Node res(Node::Type::partial, key, tags);
+				res.partialIndex = m_partialIndices.get(key);
+				return res;
 			}
 
 			void compileLocalPartial(const std::string nodeContext, std::istream& is) {
@@ -298,22 +369,97 @@ namespace amanite {
 				//if the name already exists, we omit this declaration
 				if(m_compiledTemplates.find(key) == m_compiledTemplates.end()) {
 					m_compilingTemplates.insert(key);
-					m_compiledTemplates[key].push_back({Node::Type::startScope, key, tags});
-					m_compiledTemplates[key].splice(std::end(m_compiledTemplates[key]), internalCompile(is, key));
+					SchemaScope scope(*this, nullptr);
+					std::list<Node> nodes;
+					nodes.push_back({Node::Type::startScope, key, tags});
+					nodes.splice(std::end(nodes), internalCompile(is, key));
 					//endScope is useless here because it will be handled by the end tag of the local partial
-					//m_compiledTemplates[key].push_back({Node::Type::endScope, "", tags});
+					//nodes.push_back({Node::Type::endScope, "", tags});
+					m_compiledTemplates[key] = std::make_shared<const std::list<Node>>(std::move(nodes));
 				} else {
 					//TODO : WARNING
 				}
 			}
 
 			Node compileScriptNode(const std::string node, std::istream& is) {
+#ifdef AMANITE_NO_SCRIPTING
+				throw std::invalid_argument("Code nodes are not supported without scripting : " + node);
+#else
 				return {Node::Type::code, node.substr(1)};
+#endif
+			}
+
+			/**
+			* The content of a condition is rendered in the current context, like the content of a section bound to a
+			* scalar value. Unlike a section, a condition does not push an engine state.
+			*/
+			Node compileConditionNode(const std::string node, std::istream& is) {
+				Node res = compileExpressionNode(node, is);
+				res.type = Node::Type::condition;
+				res.children = internalCompile(is);
+				//The last node is the node closing the condition.
+				res.children.pop_back();
+				return res;
+			}
+
+			Node compileExpressionNode(const std::string node, std::istream& is) {
+				std::string source = node.substr(1);
+				Node res(Node::Type::expression, source);
+				res.program = expression::Parser().parse(source);
+				res.contextOffset = res.program->contextOffset;
+				return res;
+			}
+
+
+			/**
+			* Type of the value a section reads from the frame contextOffset levels above the current one, and
+			* frames of its content : like the renderer, the frames above the resolved one are dropped, then an
+			* array pushes itself and its item, and an object itself.
+			*/
+			schema::Type::Kind enterSchemaSection(int contextOffset, const std::string& key) {
+				if(contextOffset >= static_cast<int>(m_schemaFrames.size())) {
+					m_schemaFrames.clear();
+					return schema::Type::ANY;
+				}
+				m_schemaFrames.resize(m_schemaFrames.size() - contextOffset);
+				const schema::Type* context = m_schemaFrames.back();
+				const schema::Type* type = context != nullptr ? context->getMember(key) : nullptr;
+				schema::Type::Kind kind = type != nullptr ? type->kind : schema::Type::ANY;
+				switch(kind) {
+					case schema::Type::ARRAY:
+						m_schemaFrames.push_back(type);
+						m_schemaFrames.push_back(type->items.get());
+						break;
+					case schema::Type::OBJECT:
+						m_schemaFrames.push_back(type);
+						break;
+					case schema::Type::ANY:
+						//the number of frames of the content depends on the value.
+						m_schemaFrames.clear();
+						break;
+					default:
+						//the content of a scalar section is rendered in the current context.
+						break;
+				}
+				return kind;
 			}
 
+			schema::Type::Kind getSchemaVariableType(int contextOffset, const std::string& key) const {
+				if(contextOffset >= static_cast<int>(m_schemaFrames.size()))
+					return schema::Type::ANY;
+				const schema::Type* context = m_schemaFrames[m_schemaFrames.size() - 1 - contextOffset];
+				const schema::Type* type = context != nullptr ? context->getMember(key) : nullptr;
+				if(type == nullptr)
+					return schema::Type::ANY;
+				if(type->kind == schema::Type::ARRAY || type->kind == schema::Type::OBJECT)
+					throw std::invalid_argument("Schema mismatch : the variable \"" + key + "\" is " + schema::Type::getName(type->kind));
+				return type->kind;
+			}
 
 			std::list<Node> compileVariableNode(const std::string node, std::istream& is) {
-				std::istringstream iss(node);
+				//filters follow the name and the tags, separated by '|'.
+				std::vector<std::string> filters = filter::Registry::split(node);
+				std::istringstream iss(filters[0]);
 
 				std::deque<std::string> tags{std::istream_iterator<std::string>{iss}, std::istream_iterator<std::string>{}};
 				std::string key = tags[0];
@@ -329,15 +475,21 @@ namespace amanite {
 				int currentContextOffset = 0;
 				for(auto sec : sections) {
 					if(sec.compare("parent") == 0) {
-						if(currentContextOffset > 0)
-							tags.pop_back();
-						tags.push_back("contextOffset=" + std::to_string(++currentContextOffset));
+						++currentContextOffset;
 					} else {
 						throw std::runtime_error("Variable tag must be of form \"parent.[...].variableName\"");
 					}
 				}
 
 				res.emplace_back(Node::Type::var, key, tags);
+				res.back().contextOffset = currentContextOffset;
+				res.back().valueType = getSchemaVariableType(currentContextOffset, key);
+				if(filters.size() > 1) {
+					auto chain = std::make_shared<filter::Chain>();
+					for(std::size_t i = 1; i < filters.size(); ++i)
+						chain->filters.push_back(m_filters.resolve(filters[i]));
+					res.back().filters = chain;
+				}
 				return res;
 			}
 
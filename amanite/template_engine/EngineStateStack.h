@@ -1,5 +1,11 @@
 #pragma once
 
+#include <string>
+#include <stack>
+#include <deque>
+#include <algorithm>
+#include <stdexcept>
+
 namespace amanite{
 	namespace template_engine{
 
@@ -8,8 +14,7 @@ namespace amanite{
 				bool skipText = false;
 				bool verbatim = false;
 				bool escape = false;
-
-				int contextOffset = 0;
+				bool cache = false;
 			};
 			std::stack <EngineState> m_stack;
 
@@ -27,7 +32,7 @@ namespace amanite{
 				m_stack.push(m_stack.top());
 
 				//erase all tags that are not heritable
-				resetTag(CONTEXT_OFFSET);
+				resetTag(CACHE);
 			}
 
 			/**
@@ -47,8 +52,8 @@ namespace amanite{
 			enum Tag {
 				SKIP_TEXT,
 				VERBATIM,
-				CONTEXT_OFFSET,
-				ESCAPE
+				ESCAPE,
+				CACHE
 			};
 
 			static Tag getTag(const std::string& tagStr) {
@@ -57,10 +62,10 @@ namespace amanite{
 					res = SKIP_TEXT;
 				else if(tagStr.compare("verbatim") == 0)
 					res = SKIP_TEXT;
-				else if(tagStr.compare("contextOffset") == 0)
-					res = CONTEXT_OFFSET;
 				else if(tagStr.compare("escape") == 0)
 					res = ESCAPE;
+				else if(tagStr.compare("cache") == 0)
+					res = CACHE;
 				else
 					throw std::runtime_error("BAD TAG" + tagStr);
 
@@ -82,16 +87,8 @@ namespace amanite{
 					case ESCAPE:
 						getCurrentState().escape = !negate;
 						break;
-				}
-			}
-
-			/**
-			* Apply the value tag \var tag to the state with value \var value.
-			*/
-			void applyTag(Tag tag, int value) {
-				switch(tag) {
-					case CONTEXT_OFFSET:
-						getCurrentState().contextOffset = value;
+					case CACHE:
+						getCurrentState().cache = !negate;
 						break;
 				}
 			}
@@ -101,8 +98,8 @@ namespace amanite{
 			*/
 			void resetTag(Tag tag) {
 				switch(tag) {
-					case CONTEXT_OFFSET:
-						getCurrentState().contextOffset = 0;
+					case CACHE:
+						getCurrentState().cache = false;
 						break;
 				}
 			}
@@ -113,17 +110,10 @@ namespace amanite{
 			*/
 			void applyTags(const std::deque <std::string>& tags) {
 				std::for_each(std::begin(tags), std::end(tags), [this](const std::string& tag) {
-					std::size_t pos = tag.find('=');
-					if(pos != std::string::npos) {
-						std::string tagSpelling = tag.substr(0, pos);
-						int tagValue = std::stoi(tag.substr(pos + 1));
-						applyTag(EngineStateStack::getTag(tagSpelling), tagValue);
+					if(tag[0] == '!') {
+						applyTag(EngineStateStack::getTag(tag.substr(1)), true);
 					} else {
-						if(tag[0] == '!') {
-							applyTag(EngineStateStack::getTag(tag.substr(1)), true);
-						} else {
-							applyTag(EngineStateStack::getTag(tag));
-						}
+						applyTag(EngineStateStack::getTag(tag));
 					}
 				});
 			}
@@ -0,0 +1,646 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <iterator>
+#include <ostream>
+#include <stdexcept>
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <cctype>
+
+namespace amanite {
+	namespace template_engine {
+		namespace expression {
+
+			/**
+			* Value computed by an expression. Arrays and objects are only known by their kind, and arrays by their size.
+			*
+			* Truthiness : null and false are false, numbers are true unless zero, strings and arrays unless empty,
+			* objects are always true.
+			*/
+			struct Value {
+				enum Kind {
+					NUL,
+					BOOLEAN,
+					NUMBER,
+					STRING,
+					ARRAY,
+					OBJECT
+				};
+
+				Kind kind = NUL;
+				bool boolean = false;
+				//value of a number, size of an array.
+				double number = 0;
+				std::string string;
+
+				void setNull() {
+					kind = NUL;
+				}
+
+				void setBoolean(bool b) {
+					kind = BOOLEAN;
+					boolean = b;
+				}
+
+				void setNumber(double n) {
+					kind = NUMBER;
+					number = n;
+				}
+
+				template <class String>
+				void setString(const String& s) {
+					kind = STRING;
+					string.assign(s.data(), s.size());
+				}
+
+				void setArray(std::size_t size) {
+					kind = ARRAY;
+					number = static_cast<double>(size);
+				}
+
+				void setObject() {
+					kind = OBJECT;
+				}
+
+				bool isTruthy() const {
+					switch(kind) {
+						case BOOLEAN:
+							return boolean;
+						case NUMBER:
+							return number != 0;
+						case STRING:
+							return !string.empty();
+						case ARRAY:
+							return number > 0;
+						case OBJECT:
+							return true;
+						default:
+							return false;
+					}
+				}
+
+				double toNumber() const {
+					switch(kind) {
+						case BOOLEAN:
+							return boolean ? 1 : 0;
+						case NUMBER:
+						case ARRAY:
+							return number;
+						case STRING:
+							return std::strtod(string.c_str(), nullptr);
+						default:
+							return 0;
+					}
+				}
+
+				/**
+				* Write the value the way the context adapters write theirs.
+				*/
+				void write(std::ostream& os) const {
+					switch(kind) {
+						case NUL:
+							os << "null";
+							break;
+						case BOOLEAN:
+							os << (boolean ? "true" : "false");
+							break;
+						case NUMBER:
+							os << std::to_string(number);
+							break;
+						case STRING:
+							os << string;
+							break;
+						default:
+							break;
+					}
+				}
+
+				std::string toString() const {
+					switch(kind) {
+						case NUL:
+							return "null";
+						case BOOLEAN:
+							return boolean ? "true" : "false";
+						case NUMBER:
+							return std::to_string(number);
+						case STRING:
+							return string;
+						default:
+							return "";
+					}
+				}
+			};
+
+			/**
+			* Read the value of a context into res.
+			*/
+			template <class Context>
+			void load(const Context& c, Value& res) {
+				if(c.isArray()) {
+					//getAsArray may rebuild the items, which the sections being rendered iterate.
+					res.setArray(c.getArraySize());
+				} else if(c.isObject()) {
+					res.setObject();
+				} else if(c.isBoolean()) {
+					res.setBoolean(c.getAsBoolean());
+				} else if(c.isDouble()) {
+					res.setNumber(c.getAsDouble());
+				} else if(c.isString()) {
+					res.setString(c.getAsString());
+				} else {
+					res.setNull();
+				}
+			}
+
+			/**
+			* Context value read by an expression : contextOffset levels above the current context, then through keys.
+			*/
+			struct Path {
+				int contextOffset = 0;
+				std::vector<std::string> keys;
+			};
+
+			enum class Opcode : std::uint8_t {
+				LOAD_CONSTANT,	//dst = constants[a]
+				LOAD_PATH,		//dst = value at paths[a]
+				NOT,			//dst = !a
+				NEGATE,			//dst = -a
+				TO_BOOLEAN,		//dst = a is truthy
+				LENGTH,			//dst = size of the string or array a
+				ADD,			//dst = a + b, concatenation if a or b is a string
+				SUBTRACT,
+				MULTIPLY,
+				DIVIDE,
+				MODULO,
+				EQUAL,
+				NOT_EQUAL,
+				LESS,
+				LESS_EQUAL,
+				GREATER,
+				GREATER_EQUAL,
+				JUMP,			//go to a
+				JUMP_IF_FALSE	//go to b if dst is not truthy
+			};
+
+			struct Instruction {
+				Opcode op;
+				std::uint16_t dst;
+				std::uint16_t a;
+				std::uint16_t b;
+			};
+
+			/**
+			* Compiled expression. The result is left in the register 0.
+			*/
+			struct Program {
+				std::vector<Instruction> code;
+				std::vector<Value> constants;
+				std::vector<Path> paths;
+				std::uint16_t registerCount = 1;
+				//largest contextOffset of the paths.
+				int contextOffset = 0;
+			};
+
+			/**
+			* Compile the expressions of the "?" and "%" nodes.
+			*
+			* Grammar, by increasing precedence : ternary "c ? a : b", "||", "&&", "==" and "!=", "<", "<=", ">" and ">=",
+			* "+" and "-", "*", "/" and "%", unary "!" and "-". Operands are numbers, strings between single or double
+			* quotes, true, false, null, parenthesized expressions, len(expression), and names such as "parent.item.price"
+			* read from the context like the variables.
+			*
+			* Registers are allocated as a stack : each operand is computed into the register following the registers
+			* of the pending operands.
+			*/
+			class Parser {
+			public:
+				std::shared_ptr<const Program> parse(const std::string& source) {
+					m_source = &source;
+					m_pos = 0;
+					m_program = std::make_shared<Program>();
+					m_nextRegister = 1;
+
+					parseTernary(0);
+					skipSpaces();
+					if(m_pos != source.size())
+						fail("unexpected character");
+					return m_program;
+				}
+
+			private:
+				void parseTernary(std::uint16_t dst) {
+					parseOr(dst);
+					if(!accept("?"))
+						return;
+					std::size_t jumpToElse = emit(Opcode::JUMP_IF_FALSE, dst, 0, 0);
+					parseTernary(dst);
+					std::size_t jumpToEnd = emit(Opcode::JUMP, 0, 0, 0);
+					expect(":");
+					m_program->code[jumpToElse].b = position();
+					parseTernary(dst);
+					m_program->code[jumpToEnd].a = position();
+				}
+
+				void parseOr(std::uint16_t dst) {
+					parseAnd(dst);
+					if(!peek("||"))
+						return;
+					emit(Opcode::TO_BOOLEAN, dst, dst, 0);
+					std::vector<std::size_t> jumpsToEnd;
+					while(accept("||")) {
+						//dst is true : skip the other operands.
+						std::size_t jumpToNext = emit(Opcode::JUMP_IF_FALSE, dst, 0, 0);
+						jumpsToEnd.push_back(emit(Opcode::JUMP, 0, 0, 0));
+						m_program->code[jumpToNext].b = position();
+						parseAnd(dst);
+						emit(Opcode::TO_BOOLEAN, dst, dst, 0);
+					}
+					for(std::size_t jump : jumpsToEnd)
+						m_program->code[jump].a = position();
+				}
+
+				void parseAnd(std::uint16_t dst) {
+					parseEquality(dst);
+					if(!peek("&&"))
+						return;
+					emit(Opcode::TO_BOOLEAN, dst, dst, 0);
+					std::vector<std::size_t> jumpsToEnd;
+					while(accept("&&")) {
+						jumpsToEnd.push_back(emit(Opcode::JUMP_IF_FALSE, dst, 0, 0));
+						parseEquality(dst);
+						emit(Opcode::TO_BOOLEAN, dst, dst, 0);
+					}
+					for(std::size_t jump : jumpsToEnd)
+						m_program->code[jump].b = position();
+				}
+
+				void parseEquality(std::uint16_t dst) {
+					parseComparison(dst);
+					for(;;) {
+						Opcode op;
+						if(accept("=="))
+							op = Opcode::EQUAL;
+						else if(accept("!="))
+							op = Opcode::NOT_EQUAL;
+						else
+							return;
+						std::uint16_t operand = allocate();
+						parseComparison(operand);
+						emit(op, dst, dst, operand);
+						release();
+					}
+				}
+
+				void parseComparison(std::uint16_t dst) {
+					parseAdditive(dst);
+					for(;;) {
+						Opcode op;
+						if(accept("<="))
+							op = Opcode::LESS_EQUAL;
+						else if(accept(">="))
+							op = Opcode::GREATER_EQUAL;
+						else if(accept("<"))
+							op = Opcode::LESS;
+						else if(accept(">"))
+							op = Opcode::GREATER;
+						else
+							return;
+						std::uint16_t operand = allocate();
+						parseAdditive(operand);
+						emit(op, dst, dst, operand);
+						release();
+					}
+				}
+
+				void parseAdditive(std::uint16_t dst) {
+					parseMultiplicative(dst);
+					for(;;) {
+						Opcode op;
+						if(accept("+"))
+							op = Opcode::ADD;
+						else if(accept("-"))
+							op = Opcode::SUBTRACT;
+						else
+							return;
+						std::uint16_t operand = allocate();
+						parseMultiplicative(operand);
+						emit(op, dst, dst, operand);
+						release();
+					}
+				}
+
+				void parseMultiplicative(std::uint16_t dst) {
+					parseUnary(dst);
+					for(;;) {
+						Opcode op;
+						if(accept("*"))
+							op = Opcode::MULTIPLY;
+						else if(accept("/"))
+							op = Opcode::DIVIDE;
+						else if(accept("%"))
+							op = Opcode::MODULO;
+						else
+							return;
+						std::uint16_t operand = allocate();
+						parseUnary(operand);
+						emit(op, dst, dst, operand);
+						release();
+					}
+				}
+
+				void parseUnary(std::uint16_t dst) {
+					//"!=" is not a negation.
+					if(peek("!") && !peek("!=")) {
+						accept("!");
+						parseUnary(dst);
+						emit(Opcode::NOT, dst, dst, 0);
+					} else if(accept("-")) {
+						parseUnary(dst);
+						emit(Opcode::NEGATE, dst, dst, 0);
+					} else {
+						parsePrimary(dst);
+					}
+				}
+
+				void parsePrimary(std::uint16_t dst) {
+					skipSpaces();
+					if(m_pos == m_source->size())
+						fail("unexpected end");
+
+					char c = (*m_source)[m_pos];
+					if(accept("(")) {
+						parseTernary(dst);
+						expect(")");
+					} else if(std::isdigit(static_cast<unsigned char>(c)) || c == '.') {
+						const char* start = m_source->c_str() + m_pos;
+						char* end;
+						double number = std::strtod(start, &end);
+						if(end == start)
+							fail("invalid number");
+						m_pos += end - start;
+						Value value;
+						value.setNumber(number);
+						loadConstant(dst, value);
+					} else if(c == '"' || c == '\'') {
+						std::size_t end = m_source->find(c, m_pos + 1);
+						if(end == std::string::npos)
+							fail("unterminated string");
+						Value value;
+						value.kind = Value::STRING;
+						value.string = m_source->substr(m_pos + 1, end - m_pos - 1);
+						m_pos = end + 1;
+						loadConstant(dst, value);
+					} else if(isNameStart(c)) {
+						parseName(dst);
+					} else {
+						fail("unexpected character");
+					}
+				}
+
+				void parseName(std::uint16_t dst) {
+					std::string name = readIdentifier();
+					Value value;
+					if(name == "true") {
+						value.setBoolean(true);
+						loadConstant(dst, value);
+					} else if(name == "false") {
+						value.setBoolean(false);
+						loadConstant(dst, value);
+					} else if(name == "null") {
+						loadConstant(dst, value);
+					} else if(name == "len" && accept("(")) {
+						parseTernary(dst);
+						expect(")");
+						emit(Opcode::LENGTH, dst, dst, 0);
+					} else {
+						Path path;
+						for(;;) {
+							if(name == "parent" && path.keys.empty())
+								++path.contextOffset;
+							else
+								path.keys.push_back(name);
+							if(m_pos >= m_source->size() || (*m_source)[m_pos] != '.')
+								break;
+							++m_pos;
+							name = readIdentifier();
+						}
+						m_program->contextOffset = std::max(m_program->contextOffset, path.contextOffset);
+						m_program->paths.push_back(std::move(path));
+						emit(Opcode::LOAD_PATH, dst, index(m_program->paths.size() - 1), 0);
+					}
+				}
+
+				std::string readIdentifier() {
+					std::size_t start = m_pos;
+					if(m_pos >= m_source->size() || !isNameStart((*m_source)[m_pos]))
+						fail("name expected");
+					while(m_pos < m_source->size() && (isNameStart((*m_source)[m_pos])
+							|| std::isdigit(static_cast<unsigned char>((*m_source)[m_pos]))))
+						++m_pos;
+					return m_source->substr(start, m_pos - start);
+				}
+
+				static bool isNameStart(char c) {
+					return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+				}
+
+				void loadConstant(std::uint16_t dst, const Value& value) {
+					m_program->constants.push_back(value);
+					emit(Opcode::LOAD_CONSTANT, dst, index(m_program->constants.size() - 1), 0);
+				}
+
+				std::size_t emit(Opcode op, std::uint16_t dst, std::uint16_t a, std::uint16_t b) {
+					m_program->code.push_back({op, dst, a, b});
+					return m_program->code.size() - 1;
+				}
+
+				std::uint16_t position() {
+					return index(m_program->code.size());
+				}
+
+				std::uint16_t index(std::size_t i) {
+					if(i > std::numeric_limits<std::uint16_t>::max())
+						fail("expression too large");
+					return static_cast<std::uint16_t>(i);
+				}
+
+				std::uint16_t allocate() {
+					std::uint16_t res = index(m_nextRegister++);
+					if(m_nextRegister > m_program->registerCount)
+						m_program->registerCount = index(m_nextRegister);
+					return res;
+				}
+
+				void release() {
+					--m_nextRegister;
+				}
+
+				void skipSpaces() {
+					while(m_pos < m_source->size() && std::isspace(static_cast<unsigned char>((*m_source)[m_pos])))
+						++m_pos;
+				}
+
+				bool peek(const char* token) {
+					skipSpaces();
+					return m_source->compare(m_pos, std::char_traits<char>::length(token), token) == 0;
+				}
+
+				bool accept(const char* token) {
+					if(!peek(token))
+						return false;
+					m_pos += std::char_traits<char>::length(token);
+					return true;
+				}
+
+				void expect(const char* token) {
+					if(!accept(token))
+						fail(std::string("\"") + token + "\" expected");
+				}
+
+				void fail(const std::string& message) {
+					throw std::runtime_error("Invalid expression \"" + *m_source + "\" at position "
+							+ std::to_string(m_pos) + " : " + message);
+				}
+
+				const std::string* m_source = nullptr;
+				std::size_t m_pos = 0;
+				std::shared_ptr<Program> m_program;
+				std::size_t m_nextRegister = 1;
+			};
+
+			/**
+			* Register machine running the programs. The registers are kept between runs, so that their strings keep
+			* their storage.
+			*/
+			class Machine {
+			public:
+				/**
+				* Run program, reading the context values with resolve(const Path&, Value&).
+				*/
+				template <class Resolve>
+				const Value& run(const Program& program, Resolve&& resolve) {
+					if(m_registers.size() < program.registerCount)
+						m_registers.resize(program.registerCount);
+
+					const std::size_t size = program.code.size();
+					for(std::size_t pc = 0; pc < size; ++pc) {
+						const Instruction& instruction = program.code[pc];
+						Value& dst = m_registers[instruction.dst];
+						switch(instruction.op) {
+							case Opcode::LOAD_CONSTANT:
+								dst = program.constants[instruction.a];
+								break;
+							case Opcode::LOAD_PATH:
+								resolve(program.paths[instruction.a], dst);
+								break;
+							case Opcode::NOT:
+								dst.setBoolean(!m_registers[instruction.a].isTruthy());
+								break;
+							case Opcode::NEGATE:
+								dst.setNumber(-m_registers[instruction.a].toNumber());
+								break;
+							case Opcode::TO_BOOLEAN:
+								dst.setBoolean(m_registers[instruction.a].isTruthy());
+								break;
+							case Opcode::LENGTH: {
+								const Value& a = m_registers[instruction.a];
+								dst.setNumber(a.kind == Value::STRING ? static_cast<double>(a.string.size())
+										: a.kind == Value::ARRAY ? a.number : 0);
+								break;
+							}
+							case Opcode::ADD:
+								add(dst, m_registers[instruction.a], m_registers[instruction.b]);
+								break;
+							case Opcode::SUBTRACT:
+								dst.setNumber(m_registers[instruction.a].toNumber() - m_registers[instruction.b].toNumber());
+								break;
+							case Opcode::MULTIPLY:
+								dst.setNumber(m_registers[instruction.a].toNumber() * m_registers[instruction.b].toNumber());
+								break;
+							case Opcode::DIVIDE:
+								dst.setNumber(m_registers[instruction.a].toNumber() / m_registers[instruction.b].toNumber());
+								break;
+							case Opcode::MODULO:
+								dst.setNumber(std::fmod(m_registers[instruction.a].toNumber(), m_registers[instruction.b].toNumber()));
+								break;
+							case Opcode::EQUAL:
+								dst.setBoolean(equals(m_registers[instruction.a], m_registers[instruction.b]));
+								break;
+							case Opcode::NOT_EQUAL:
+								dst.setBoolean(!equals(m_registers[instruction.a], m_registers[instruction.b]));
+								break;
+							case Opcode::LESS:
+								dst.setBoolean(compare(m_registers[instruction.a], m_registers[instruction.b]) < 0);
+								break;
+							case Opcode::LESS_EQUAL:
+								dst.setBoolean(compare(m_registers[instruction.a], m_registers[instruction.b]) <= 0);
+								break;
+							case Opcode::GREATER:
+								dst.setBoolean(compare(m_registers[instruction.a], m_registers[instruction.b]) > 0);
+								break;
+							case Opcode::GREATER_EQUAL:
+								dst.setBoolean(compare(m_registers[instruction.a], m_registers[instruction.b]) >= 0);
+								break;
+							case Opcode::JUMP:
+								pc = instruction.a - 1;
+								break;
+							case Opcode::JUMP_IF_FALSE:
+								if(!dst.isTruthy())
+									pc = instruction.b - 1;
+								break;
+						}
+					}
+					return m_registers[0];
+				}
+
+			private:
+				static void add(Value& dst, const Value& a, const Value& b) {
+					if(a.kind == Value::STRING || b.kind == Value::STRING) {
+						//dst may be a.
+						std::string res = a.toString();
+						res += b.toString();
+						dst.kind = Value::STRING;
+						dst.string.swap(res);
+					} else {
+						dst.setNumber(a.toNumber() + b.toNumber());
+					}
+				}
+
+				static bool equals(const Value& a, const Value& b) {
+					if(a.kind != b.kind)
+						return false;
+					switch(a.kind) {
+						case Value::BOOLEAN:
+							return a.boolean == b.boolean;
+						case Value::NUMBER:
+						case Value::ARRAY:
+							return a.number == b.number;
+						case Value::STRING:
+							return a.string == b.string;
+						default:
+							return true;
+					}
+				}
+
+				/**
+				* Strings compare as strings, everything else as numbers.
+				*/
+				static int compare(const Value& a, const Value& b) {
+					if(a.kind == Value::STRING && b.kind == Value::STRING)
+						return a.string.compare(b.string);
+					double x = a.toNumber();
+					double y = b.toNumber();
+					return x < y ? -1 : x > y ? 1 : 0;
+				}
+
+				std::vector<Value> m_registers;
+			};
+		}
+	}
+}
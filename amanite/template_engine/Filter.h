@@ -0,0 +1,292 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+#include <streambuf>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+#include <ctime>
+
+#include "Expression.h"
+
+namespace amanite {
+	namespace template_engine {
+		namespace filter {
+
+			/**
+			* Argument of a filter, following its name and ':' in the tag. It is parsed once, when the template is compiled.
+			* An argument containing '|' is written between double quotes, in which a backslash escapes '"' and itself.
+			*/
+			struct Argument {
+				std::string text;
+				//text read as a number, 0 if it is not one.
+				double number = 0;
+			};
+
+			/**
+			* A filter writes the transformation of value to os.
+			*/
+			typedef void (*Function)(std::ostream& os, const expression::Value& value, const Argument& argument);
+
+			struct Filter {
+				std::string name;
+				Function function;
+				Argument argument;
+			};
+
+			/**
+			* Stream buffer keeping what is written to it in a string, whose storage is reused once it has been cleared.
+			*/
+			class Buffer : public std::streambuf {
+			public:
+				Buffer() : m_stream(this) {
+				}
+
+				std::ostream& getStream() {
+					return m_stream;
+				}
+
+				std::string& getString() {
+					return m_string;
+				}
+
+			protected:
+				int overflow(int c) override {
+					if(c != traits_type::eof())
+						m_string += static_cast<char>(c);
+					return traits_type::not_eof(c);
+				}
+
+				std::streamsize xsputn(const char* s, std::streamsize n) override {
+					m_string.append(s, static_cast<std::size_t>(n));
+					return n;
+				}
+
+			private:
+				std::string m_string;
+				std::ostream m_stream;
+			};
+
+			/**
+			* Filters of a variable node, applied from left to right.
+			*/
+			struct Chain {
+				std::vector<Filter> filters;
+
+				/**
+				* Write value to os through the filters. The output of each filter but the last one is written to buffer,
+				* and becomes the value of the next one.
+				*/
+				void apply(expression::Value& value, std::ostream& os, Buffer& buffer) const {
+					for(std::size_t i = 0; i + 1 < filters.size(); ++i) {
+						buffer.getString().clear();
+						filters[i].function(buffer.getStream(), value, filters[i].argument);
+						value.kind = expression::Value::STRING;
+						value.string.swap(buffer.getString());
+					}
+					filters.back().function(os, value, filters.back().argument);
+				}
+			};
+
+			/**
+			* Filters that the compiler can resolve, by name. The built-in filters are :
+			* - upper, lower : change the case of ASCII letters.
+			* - escape : escape the HTML special characters.
+			* - fixed:N : write a number with N decimals.
+			* - truncate:N : keep the N first bytes, without splitting UTF-8 sequences, followed by "..." if the text was longer.
+			* - strftime:FORMAT : format a number of seconds since the epoch, in UTC.
+			* - default:TEXT : write TEXT instead of null or of an empty string.
+			*/
+			class Registry {
+			public:
+				Registry() {
+					add("upper", &upper);
+					add("lower", &lower);
+					add("escape", &escape);
+					add("fixed", &fixed);
+					add("truncate", &truncate);
+					add("strftime", &strftime);
+					add("default", &defaultText);
+				}
+
+				void add(const std::string& name, Function function) {
+					m_functions[name] = function;
+				}
+
+				/**
+				* Split the content of a var tag on the '|' outside of the quoted arguments : the variable and its
+				* tags, then the spelling of each filter.
+				*/
+				static std::vector<std::string> split(const std::string& tag) {
+					std::vector<std::string> res(1);
+					bool quoted = false;
+					for(std::size_t i = 0; i < tag.size(); ++i) {
+						char c = tag[i];
+						if(c == '|' && !quoted) {
+							res.emplace_back();
+							continue;
+						}
+						if(quoted && c == '\\' && i + 1 < tag.size()) {
+							res.back() += c;
+							c = tag[++i];
+						} else if(c == '"' && res.size() > 1) {
+							quoted = !quoted;
+						}
+						res.back() += c;
+					}
+					return res;
+				}
+
+				/**
+				* Filter written as "name" or "name:argument" in a tag.
+				*/
+				Filter resolve(const std::string& spelling) const {
+					std::size_t separator = spelling.find(':');
+					Filter res;
+					res.name = trim(spelling.substr(0, separator));
+					auto function = m_functions.find(res.name);
+					if(function == m_functions.end())
+						throw std::runtime_error("Unknown filter \"" + res.name + "\"");
+					res.function = function->second;
+					if(separator != std::string::npos) {
+						res.argument.text = unquote(trim(spelling.substr(separator + 1)));
+						res.argument.number = std::strtod(res.argument.text.c_str(), nullptr);
+					}
+					return res;
+				}
+
+			private:
+				static std::string unquote(const std::string& s) {
+					if(s.size() < 2 || s.front() != '"' || s.back() != '"')
+						return s;
+					std::string res;
+					for(std::size_t i = 1; i + 1 < s.size(); ++i) {
+						if(s[i] == '\\' && i + 2 < s.size())
+							++i;
+						res += s[i];
+					}
+					return res;
+				}
+
+				static std::string trim(const std::string& s) {
+					std::size_t start = 0;
+					std::size_t end = s.size();
+					while(start < end && std::isspace(static_cast<unsigned char>(s[start])))
+						++start;
+					while(end > start && std::isspace(static_cast<unsigned char>(s[end - 1])))
+						--end;
+					return s.substr(start, end - start);
+				}
+
+				/**
+				* Call f with the text of value, without copying strings.
+				*/
+				template <class F>
+				static void withText(const expression::Value& value, F f) {
+					if(value.kind == expression::Value::STRING)
+						f(value.string);
+					else
+						f(value.toString());
+				}
+
+				static void upper(std::ostream& os, const expression::Value& value, const Argument&) {
+					withText(value, [&](const std::string& text) {
+						for(char c : text)
+							os.put(static_cast<char>(std::toupper(static_cast<unsigned char>(c))));
+					});
+				}
+
+				static void lower(std::ostream& os, const expression::Value& value, const Argument&) {
+					withText(value, [&](const std::string& text) {
+						for(char c : text)
+							os.put(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+					});
+				}
+
+				static void escape(std::ostream& os, const expression::Value& value, const Argument&) {
+					withText(value, [&](const std::string& text) {
+						std::size_t start = 0;
+						for(std::size_t i = 0; i < text.size(); ++i) {
+							const char* entity;
+							switch(text[i]) {
+								case '&': entity = "&amp;"; break;
+								case '<': entity = "&lt;"; break;
+								case '>': entity = "&gt;"; break;
+								case '"': entity = "&quot;"; break;
+								case '\'': entity = "&#39;"; break;
+								default: continue;
+							}
+							os.write(text.data() + start, i - start);
+							os << entity;
+							start = i + 1;
+						}
+						os.write(text.data() + start, text.size() - start);
+					});
+				}
+
+				static void fixed(std::ostream& os, const expression::Value& value, const Argument& argument) {
+					char buffer[64];
+					int size = std::snprintf(buffer, sizeof(buffer), "%.*f", static_cast<int>(argument.number), value.toNumber());
+					if(size >= 0 && static_cast<std::size_t>(size) < sizeof(buffer))
+						os.write(buffer, size);
+					else
+						os << std::to_string(value.toNumber());
+				}
+
+				static void truncate(std::ostream& os, const expression::Value& value, const Argument& argument) {
+					withText(value, [&](const std::string& text) {
+						std::size_t size = argument.number > 0 ? static_cast<std::size_t>(argument.number) : 0;
+						if(text.size() <= size) {
+							os << text;
+							return;
+						}
+						//do not cut before a continuation byte.
+						while(size > 0 && (static_cast<unsigned char>(text[size]) & 0xC0) == 0x80)
+							--size;
+						os.write(text.data(), size);
+						os << "...";
+					});
+				}
+
+				static void strftime(std::ostream& os, const expression::Value& value, const Argument& argument) {
+					std::time_t time = static_cast<std::time_t>(value.toNumber());
+					std::tm tm;
+#ifdef _WIN32
+					gmtime_s(&tm, &time);
+#else
+					gmtime_r(&time, &tm);
+#endif
+					char buffer[256];
+					std::size_t size = std::strftime(buffer, sizeof(buffer), argument.text.c_str(), &tm);
+					if(size > 0) {
+						os.write(buffer, size);
+						return;
+					}
+					//strftime returns 0 if the buffer is too small, or if the output is empty : a heap buffer is grown
+					//up to a bound proportional to the format.
+					std::size_t maxSize = argument.text.size() * 256;
+					for(std::vector<char> larger(2 * sizeof(buffer)); larger.size() <= maxSize; larger.resize(2 * larger.size())) {
+						size = std::strftime(larger.data(), larger.size(), argument.text.c_str(), &tm);
+						if(size > 0) {
+							os.write(larger.data(), size);
+							return;
+						}
+					}
+				}
+
+				static void defaultText(std::ostream& os, const expression::Value& value, const Argument& argument) {
+					if(value.kind == expression::Value::NUL || (value.kind == expression::Value::STRING && value.string.empty()))
+						os << argument.text;
+					else
+						value.write(os);
+				}
+
+				std::map<std::string, Function> m_functions;
+			};
+		}
+	}
+}
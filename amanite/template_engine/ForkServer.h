@@ -0,0 +1,305 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <memory>
+#include <functional>
+#include <new>
+#include <iostream>
+#include <streambuf>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "Compiler.h"
+#include "Linker.h"
+#include "Renderer.h"
+
+namespace amanite {
+	namespace template_engine {
+
+		/**
+		* Warm start of worker processes : the process owning the fork server compiles the templates, builds and
+		* primes the script engine of a renderer and touches every compiled page, then workers are forked from it
+		* and share all of that copy-on-write. A worker is ready as soon as it is forked.
+		*
+		* Workers are forked either by the calling process (spawn), or by a zygote process forked once everything
+		* is ready (start), so that the memory of the workers does not depend on what the calling process did
+		* afterwards. The workers forked by the zygote are its children, not those of the calling process, which
+		* can not wait for them : the zygote reaps them, and stop() waits for them. POSIX only.
+		*/
+		template <class Context>
+		class ForkServer {
+		public:
+			/**
+			* Body of a worker, whose result is the exit status of the process.
+			*/
+			typedef std::function<int(ForkServer& server, std::size_t index)> Worker;
+
+			ForkServer(Compiler& compiler) : m_compiler(compiler) {
+			}
+
+			~ForkServer() {
+				try {
+					stop();
+				} catch(...) {
+				}
+			}
+
+			ForkServer(const ForkServer&) = delete;
+			ForkServer& operator=(const ForkServer&) = delete;
+
+			/**
+			* Compile and link a template, available to the workers.
+			*/
+			const CompiledTemplate& add(const std::string& name) {
+				auto it = m_templates.find(name);
+				if(it == m_templates.end()) {
+					auto tmpl = std::make_shared<CompiledTemplate>(m_compiler.compile(name));
+					Linker().link(*tmpl);
+					it = m_templates.emplace(name, tmpl).first;
+				}
+				return *it->second;
+			}
+
+			const CompiledTemplate& get(const std::string& name) const {
+				auto it = m_templates.find(name);
+				if(it == m_templates.end())
+					throw std::invalid_argument("The template " + name + " has not been compiled by the fork server.");
+				return *it->second;
+			}
+
+			/**
+			* Renderer built before the fork, whose script engine is shared by the workers.
+			*/
+			Renderer<Context>& getRenderer() {
+				return m_renderer;
+			}
+
+			/**
+			* Prime the script engine and touch the compiled templates. If sample is given, every template is
+			* rendered against it once, to a discarded output, so that the lazy initializations of the renderer
+			* and of the script bindings are done too : rendering errors are ignored.
+			*/
+			void warmUp(const Context* sample = nullptr) {
+#ifndef AMANITE_NO_SCRIPTING
+				//the first evaluation builds the engine, its parser and its dispatch caches.
+				m_renderer.getScriptEngine().eval("0;");
+#endif
+				for(const auto& tmpl : m_templates) {
+					touch(tmpl.second->getNodes());
+					for(const auto& dep : tmpl.second->getDeps())
+						touch(*dep.second);
+				}
+				if(sample == nullptr)
+					return;
+				NullBuffer discard;
+				std::ostream os(&discard);
+				for(const auto& tmpl : m_templates) {
+					try {
+						m_renderer.render(*sample, os, *tmpl.second);
+					} catch(const std::exception&) {
+					}
+				}
+			}
+
+			/**
+			* Fork the zygote : the following workers are forked by it, and all run worker (see spawn(index)).
+			*/
+			void start(const Worker& worker) {
+				if(m_zygote > 0)
+					throw std::logic_error("The zygote is already started.");
+				int requests[2];
+				int responses[2];
+				if(pipe(requests) != 0)
+					fail("pipe");
+				if(pipe(responses) != 0) {
+					close(requests[0]);
+					close(requests[1]);
+					fail("pipe");
+				}
+				std::cout.flush();
+				std::cerr.flush();
+				pid_t pid = ::fork();
+				if(pid < 0)
+					fail("fork");
+				if(pid == 0) {
+					close(requests[1]);
+					close(responses[0]);
+					runZygote(worker, requests[0], responses[1]);
+				}
+				close(requests[0]);
+				close(responses[1]);
+				m_zygote = pid;
+				m_requests = requests[1];
+				m_responses = responses[0];
+			}
+
+			/**
+			* Fork a worker from the calling process, which has to wait for it. Return its pid.
+			* Once the zygote is started, the workers can only be forked by it (see spawn(index)).
+			*/
+			pid_t spawn(const Worker& worker, std::size_t index) {
+				if(m_zygote > 0)
+					throw std::logic_error("The zygote is started : its workers run the worker given to start.");
+				return fork(worker, index);
+			}
+
+			/**
+			* Fork a worker of the zygote, running the worker given to start. Return its pid, which is a child of
+			* the zygote : the calling process can not wait for it.
+			*/
+			pid_t spawn(std::size_t index) {
+				if(m_zygote <= 0)
+					throw std::logic_error("The zygote is not started.");
+				std::uint64_t request = index;
+				pid_t res;
+				writeAll(m_requests, &request, sizeof(request));
+				if(!readAll(m_responses, &res, sizeof(res)) || res < 0)
+					throw std::runtime_error("The zygote could not fork a worker.");
+				return res;
+			}
+
+			/**
+			* Stop the zygote, once all its workers have exited.
+			*/
+			void stop() {
+				if(m_zygote <= 0)
+					return;
+				close(m_requests);
+				close(m_responses);
+				int status;
+				while(waitpid(m_zygote, &status, 0) < 0 && errno == EINTR) {
+				}
+				m_zygote = -1;
+			}
+
+		private:
+			class NullBuffer : public std::streambuf {
+			protected:
+				int overflow(int c) override {
+					return traits_type::not_eof(c);
+				}
+
+				std::streamsize xsputn(const char*, std::streamsize n) override {
+					return n;
+				}
+			};
+
+			pid_t fork(const Worker& worker, std::size_t index) {
+				std::cout.flush();
+				std::cerr.flush();
+				pid_t pid = ::fork();
+				if(pid < 0)
+					fail("fork");
+				if(pid > 0)
+					return pid;
+
+				if(m_zygote == 0) {
+					close(m_requests);
+					close(m_responses);
+				}
+				int status = 1;
+				try {
+					status = worker(*this, index);
+				} catch(const std::exception& e) {
+					std::cerr << "worker " << index << " : " << e.what() << std::endl;
+				}
+				std::cout.flush();
+				std::cerr.flush();
+				_exit(status);
+			}
+
+			void runZygote(const Worker& worker, int requests, int responses) {
+				m_zygote = 0;
+				m_requests = requests;
+				m_responses = responses;
+				std::uint64_t index;
+				while(readAll(requests, &index, sizeof(index))) {
+					while(waitpid(-1, nullptr, WNOHANG) > 0) {
+					}
+					pid_t pid = -1;
+					try {
+						pid = fork(worker, static_cast<std::size_t>(index));
+					} catch(const std::exception&) {
+					}
+					if(!writeAll(responses, &pid, sizeof(pid), std::nothrow))
+						break;
+				}
+				while(wait(nullptr) > 0 || errno == EINTR) {
+				}
+				_exit(0);
+			}
+
+			/**
+			* Read the strings of the nodes, a byte per cache line, so that their pages are resident before the fork.
+			*/
+			void touch(const std::list<Node>& nodes) {
+				for(const Node& node : nodes) {
+					touch(node.value);
+					for(const std::string& tag : node.tags)
+						touch(tag);
+					touch(node.children);
+				}
+			}
+
+			void touch(const std::string& s) {
+				for(std::size_t i = 0; i < s.size(); i += 64)
+					m_touched += static_cast<unsigned char>(s[i]);
+			}
+
+			static bool readAll(int fd, void* data, std::size_t size) {
+				char* p = static_cast<char*>(data);
+				while(size > 0) {
+					ssize_t res = read(fd, p, size);
+					if(res < 0 && errno == EINTR)
+						continue;
+					if(res <= 0)
+						return false;
+					p += res;
+					size -= static_cast<std::size_t>(res);
+				}
+				return true;
+			}
+
+			static bool writeAll(int fd, const void* data, std::size_t size, const std::nothrow_t&) {
+				const char* p = static_cast<const char*>(data);
+				while(size > 0) {
+					ssize_t res = write(fd, p, size);
+					if(res < 0 && errno == EINTR)
+						continue;
+					if(res <= 0)
+						return false;
+					p += res;
+					size -= static_cast<std::size_t>(res);
+				}
+				return true;
+			}
+
+			static void writeAll(int fd, const void* data, std::size_t size) {
+				if(!writeAll(fd, data, size, std::nothrow))
+					fail("write");
+			}
+
+			static void fail(const char* call) {
+				throw std::runtime_error(std::string(call) + " failed : " + std::strerror(errno));
+			}
+
+			Compiler& m_compiler;
+			std::map<std::string, std::shared_ptr<const CompiledTemplate>> m_templates;
+			Renderer<Context> m_renderer;
+			//pid of the zygote in the calling process, 0 in the zygote and its workers, -1 without zygote.
+			pid_t m_zygote = -1;
+			int m_requests = -1;
+			int m_responses = -1;
+			unsigned m_touched = 0;
+		};
+	}
+}
@@ -0,0 +1,265 @@
+#pragma once
+
+#include <string>
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <algorithm>
+#include <iterator>
+#include <tuple>
+
+#include "CompiledTemplate.h"
+#include "Node.h"
+
+namespace amanite {
+	namespace template_engine {
+
+		/**
+		* Memoize the rendered output of sections.
+		*
+		* A fragment is identified by its section node and by the identities of the context values it reads,
+		* so that a section bound to an unchanged value is rendered only once. Sections are cached if they have
+		* the "cache" tag, or if the cacheAllSections option is set.
+		* Sections containing code nodes are never cached, since scripts may read anything.
+		*
+		* The cache only holds weak references to the context values, so that it does not keep their documents
+		* alive : the fragments of destroyed values are dropped. Fragments are evicted in least recently used order
+		* once maxBytes is exceeded.
+		* Nodes are identified by their address : clear the cache before destroying the templates it was used with.
+		*/
+		class FragmentCache {
+		private:
+			struct Configuration {
+				Configuration() :
+						maxBytes(16 * 1024 * 1024),
+						cacheAllSections(false) {
+
+				}
+
+				std::size_t maxBytes;
+				bool cacheAllSections;
+			};
+
+			Configuration m_configuration;
+
+		public:
+			Configuration& getConfiguration() {
+				return m_configuration;
+			}
+
+			const Configuration& getConfiguration() const {
+				return m_configuration;
+			}
+
+			struct Statistics {
+				std::size_t hits = 0;
+				std::size_t misses = 0;
+				std::size_t evictions = 0;
+				std::size_t entries = 0;
+				std::size_t bytes = 0;
+			};
+
+			struct Key {
+				const Node* node = nullptr;
+				bool skipText = false;
+				//identities of the section value and of the parent contexts read by the section.
+				std::vector<std::shared_ptr<const void>> identities;
+			};
+
+		private:
+			/**
+			* Key of the index : the addresses of the identities. An address may be reused once its value is
+			* destroyed, so the entries also keep weak references to check the owners of the identities.
+			*/
+			struct StoredKey {
+				const Node* node = nullptr;
+				bool skipText = false;
+				std::vector<const void*> addresses;
+
+				bool operator<(const StoredKey& other) const {
+					return std::tie(node, skipText, addresses) < std::tie(other.node, other.skipText, other.addresses);
+				}
+			};
+
+			struct Entry {
+				StoredKey key;
+				std::vector<std::weak_ptr<const void>> identities;
+				std::string fragment;
+			};
+
+			std::list<Entry> m_entries;
+			std::map<StoredKey, std::list<Entry>::iterator> m_index;
+			std::map<const Node*, int> m_parentReads;
+			Statistics m_statistics;
+			//inserts since the expired entries were last dropped.
+			std::size_t m_inserts = 0;
+			mutable std::mutex m_mutex;
+
+		public:
+			/**
+			* Write the fragment stored for key to os. Return false if there is no such fragment.
+			*/
+			bool write(const Key& key, std::ostream& os) {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				auto item = m_index.find(toStoredKey(key));
+				if(item != m_index.end() && !isOwnedBy(*item->second, key)) {
+					erase(item->second);
+					item = m_index.end();
+				}
+				if(item == m_index.end()) {
+					++m_statistics.misses;
+					return false;
+				}
+				++m_statistics.hits;
+				m_entries.splice(m_entries.begin(), m_entries, item->second);
+				os << item->second->fragment;
+				return true;
+			}
+
+			void insert(const Key& key, const std::string& fragment) {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				Entry entry{toStoredKey(key), {key.identities.begin(), key.identities.end()}, fragment};
+				std::size_t size = entrySize(entry);
+				if(size > getConfiguration().maxBytes)
+					return;
+				auto item = m_index.find(entry.key);
+				if(item != m_index.end()) {
+					if(isOwnedBy(*item->second, key))
+						return;
+					erase(item->second);
+				}
+
+				//amortized : the entries are scanned once there have been more inserts than the entries left by the
+				//previous scan.
+				if(++m_inserts > m_statistics.entries / 2) {
+					dropExpired();
+					m_inserts = 0;
+				}
+
+				m_entries.push_front(std::move(entry));
+				m_index.emplace(m_entries.front().key, m_entries.begin());
+				m_statistics.bytes += size;
+				++m_statistics.entries;
+
+				while(m_statistics.bytes > getConfiguration().maxBytes) {
+					++m_statistics.evictions;
+					erase(std::prev(m_entries.end()));
+				}
+			}
+
+			void clear() {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_index.clear();
+				m_entries.clear();
+				m_parentReads.clear();
+				m_statistics.entries = 0;
+				m_statistics.bytes = 0;
+				m_inserts = 0;
+			}
+
+			Statistics getStatistics() const {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				return m_statistics;
+			}
+
+			/**
+			* Number of parent contexts, above the context of the section, that the content of a section may read.
+			* Return -1 if the section can not be cached.
+			*/
+			int getParentReads(const Node& section, const Dependencies& deps) {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				auto item = m_parentReads.find(&section);
+				if(item == m_parentReads.end()) {
+					std::set<std::string> visitedPartials;
+					item = m_parentReads.emplace(&section, parentReads(section.children, deps, visitedPartials)).first;
+				}
+				return item->second;
+			}
+
+		private:
+			static StoredKey toStoredKey(const Key& key) {
+				StoredKey res;
+				res.node = key.node;
+				res.skipText = key.skipText;
+				for(const auto& identity : key.identities)
+					res.addresses.push_back(identity.get());
+				return res;
+			}
+
+			/**
+			* Whether the identities of the entry have the owners of those of key, rather than being destroyed
+			* values whose addresses have been reused.
+			*/
+			static bool isOwnedBy(const Entry& entry, const Key& key) {
+				for(std::size_t i = 0; i < entry.identities.size(); ++i) {
+					if(entry.identities[i].owner_before(key.identities[i]) || key.identities[i].owner_before(entry.identities[i]))
+						return false;
+				}
+				return true;
+			}
+
+			/**
+			* Identities without an owner, such as those of the native values, can not expire.
+			*/
+			static bool isExpired(const std::weak_ptr<const void>& identity) {
+				const std::weak_ptr<const void> none;
+				return identity.expired() && (identity.owner_before(none) || none.owner_before(identity));
+			}
+
+			void dropExpired() {
+				for(auto entry = m_entries.begin(); entry != m_entries.end();) {
+					auto next = std::next(entry);
+					if(std::any_of(entry->identities.begin(), entry->identities.end(), &isExpired))
+						erase(entry);
+					entry = next;
+				}
+			}
+
+			void erase(std::list<Entry>::iterator entry) {
+				m_statistics.bytes -= entrySize(*entry);
+				--m_statistics.entries;
+				m_index.erase(entry->key);
+				m_entries.erase(entry);
+			}
+
+			static std::size_t entrySize(const Entry& entry) {
+				return sizeof(Entry) + entry.fragment.size()
+						+ entry.identities.size() * (sizeof(std::weak_ptr<const void>) + sizeof(const void*));
+			}
+
+			static int parentReads(const std::list<Node>& nodes, const Dependencies& deps, std::set<std::string>& visitedPartials) {
+				int res = 0;
+				for(auto& node : nodes) {
+					int reads = 0;
+					switch(node.type) {
+						case Node::Type::code:
+							return -1;
+						case Node::Type::partial: {
+							if(!visitedPartials.insert(node.value).second)
+								break;
+							auto dep = deps.find(node.value);
+							reads = dep == deps.end() ? 0 : parentReads(*dep->second, deps, visitedPartials);
+							break;
+						}
+						default:
+							reads = node.contextOffset;
+							if(!node.children.empty()) {
+								int childrenReads = parentReads(node.children, deps, visitedPartials);
+								if(childrenReads < 0)
+									return -1;
+								reads = std::max(reads, childrenReads);
+							}
+					}
+					if(reads < 0)
+						return -1;
+					res = std::max(res, reads);
+				}
+				return res;
+			}
+		};
+	}
+}
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <string>
+#include <list>
+#include <map>
+#include <set>
+#include <tuple>
+#include <memory>
+#include <cctype>
+
+#include "CompiledTemplate.h"
+#include "Node.h"
+
+namespace amanite {
+	namespace template_engine {
+
+		/**
+		* Removes insignificant whitespace and comments from the text nodes of HTML templates.
+		*
+		* The text nodes are read in document order as a single HTML text, so that an element or a tag may be split
+		* by template nodes. Outside of the pre, textarea, script and style elements, runs of whitespace are replaced
+		* by a single newline, or by a single space if the run does not contain one, and comments are removed.
+		* Conditional comments, and comments containing template nodes, are kept.
+		*
+		* Partials are read in the state of the HTML text at the point where they are used. A partial used in
+		* several states, for instance inside and outside of a pre element, gets a variant per state, named after
+		* the partial followed by '@' and a number. The minifier keeps its variants from a template to the next, so
+		* that the templates sharing a partial share its variants too (see Compiler).
+		*/
+		class HtmlMinifier {
+		public:
+			/**
+			* partialIndices : indices given to the partial nodes renamed to a variant, -1 if nullptr (see Linker).
+			*/
+			explicit HtmlMinifier(PartialIndices* partialIndices = nullptr) : m_partialIndices(partialIndices) {
+			}
+
+			/**
+			* Size of the text nodes before and after the minification.
+			*/
+			struct Report {
+				std::size_t bytesBefore = 0;
+				std::size_t bytesAfter = 0;
+			};
+
+			Report minify(CompiledTemplate& tmpl) {
+				m_report = Report();
+				m_source = &tmpl.getDeps();
+				tmpl.unlink();
+				minify(tmpl.getNodes(), State());
+
+				//only the variants the template uses are added, with the bytes of their text nodes.
+				std::set<const Variant*> visited;
+				addVariants(tmpl.getNodes(), tmpl.getDeps(), visited);
+				m_source = nullptr;
+				return m_report;
+			}
+
+		private:
+			struct State {
+				//raw text element (pre, textarea, script, style) the text is in.
+				std::string rawElement;
+				//name of the opening tag the text is in.
+				std::string tagName;
+				bool inTag = false;
+				//quote of the attribute value the text is in.
+				char quote = 0;
+				//comment kept because it contains template nodes.
+				bool inComment = false;
+
+				bool operator<(const State& other) const {
+					return std::tie(rawElement, tagName, inTag, quote, inComment)
+							< std::tie(other.rawElement, other.tagName, other.inTag, other.quote, other.inComment);
+				}
+			};
+
+			struct Variant {
+				//partial the variant is made from, kept alive so that its address can not be reused.
+				SharedNodes source;
+				std::string name;
+				SharedNodes nodes;
+				State exitState;
+				//bytes of the text nodes of the variant, without the partials it uses.
+				Report report;
+			};
+
+			State minify(std::list<Node>& nodes, State state) {
+				for(Node& node : nodes) {
+					switch(node.type) {
+						case Node::Type::text:
+							m_report.bytesBefore += node.value.size();
+							node.value = minifyText(node.value, state);
+							m_report.bytesAfter += node.value.size();
+							break;
+						case Node::Type::partial:
+							state = minifyPartial(node, state);
+							break;
+						default:
+							state = minify(node.children, state);
+					}
+				}
+				return state;
+			}
+
+			State minifyPartial(Node& node, const State& state) {
+				auto source = m_source->find(node.value);
+				if(source == m_source->end())
+					return state;
+				auto key = std::make_pair(source->second.get(), state);
+				auto variant = m_variants.find(key);
+				if(variant == m_variants.end()) {
+					int count = m_variantCounts[node.value]++;
+					std::string name = count == 0 ? node.value : node.value + "@" + std::to_string(count);
+					//registered before the partial is read, so that recursive partials end. They are assumed to leave
+					//the state unchanged.
+					variant = m_variants.emplace(key, Variant{source->second, name, nullptr, state, Report()}).first;
+					m_variantsByName[name] = &variant->second;
+
+					Report report = m_report;
+					m_report = Report();
+					std::list<Node> nodes = *source->second;
+					State exitState = minify(nodes, state);
+					variant->second.nodes = std::make_shared<const std::list<Node>>(std::move(nodes));
+					variant->second.exitState = exitState;
+					variant->second.report = m_report;
+					m_report = report;
+				}
+				node.value = variant->second.name;
+				node.partialIndex = m_partialIndices != nullptr ? m_partialIndices->get(node.value) : -1;
+				return variant->second.exitState;
+			}
+
+			void addVariants(const std::list<Node>& nodes, Dependencies& deps, std::set<const Variant*>& visited) {
+				for(const Node& node : nodes) {
+					if(node.type == Node::Type::partial) {
+						auto variant = m_variantsByName.find(node.value);
+						if(variant != m_variantsByName.end() && visited.insert(variant->second).second) {
+							deps[node.value] = variant->second->nodes;
+							m_report.bytesBefore += variant->second->report.bytesBefore;
+							m_report.bytesAfter += variant->second->report.bytesAfter;
+							addVariants(*variant->second->nodes, deps, visited);
+						}
+					}
+					addVariants(node.children, deps, visited);
+				}
+			}
+
+			std::string minifyText(const std::string& text, State& state) {
+				std::string res;
+				res.reserve(text.size());
+				std::size_t i = 0;
+				while(i < text.size()) {
+					if(!state.rawElement.empty()) {
+						std::size_t end = findClosingTag(text, i, state.rawElement);
+						res.append(text, i, end - i);
+						i = end;
+						if(end < text.size())
+							state.rawElement.clear();
+					} else if(state.inComment) {
+						std::size_t end = text.find("-->", i);
+						if(end == std::string::npos) {
+							res.append(text, i, std::string::npos);
+							i = text.size();
+						} else {
+							res.append(text, i, end + 3 - i);
+							state.inComment = false;
+							i = end + 3;
+						}
+					} else if(state.inTag) {
+						char c = text[i];
+						if(state.quote != 0) {
+							if(c == state.quote)
+								state.quote = 0;
+							res += c;
+							++i;
+						} else if(isSpace(c)) {
+							i = skipSpaces(text, i);
+							res += ' ';
+						} else {
+							if(c == '"' || c == '\'') {
+								state.quote = c;
+							} else if(c == '>') {
+								state.inTag = false;
+								if(isRawElement(state.tagName))
+									state.rawElement = state.tagName;
+							}
+							res += c;
+							++i;
+						}
+					} else if(text.compare(i, 4, "<!--") == 0) {
+						std::size_t end = text.find("-->", i + 4);
+						if(end == std::string::npos) {
+							//the comment contains template nodes.
+							res.append(text, i, std::string::npos);
+							state.inComment = true;
+							i = text.size();
+						} else {
+							if(isConditionalComment(text, i))
+								res.append(text, i, end + 3 - i);
+							i = end + 3;
+						}
+					} else if(text[i] == '<' && i + 1 < text.size() && (std::isalpha(static_cast<unsigned char>(text[i + 1])) || text[i + 1] == '/' || text[i + 1] == '!')) {
+						std::size_t nameStart = text[i + 1] == '/' || text[i + 1] == '!' ? i + 2 : i + 1;
+						std::size_t nameEnd = nameStart;
+						while(nameEnd < text.size() && std::isalnum(static_cast<unsigned char>(text[nameEnd])))
+							++nameEnd;
+						state.inTag = true;
+						state.tagName = text[i + 1] == '/' || text[i + 1] == '!' ? "" : toLower(text.substr(nameStart, nameEnd - nameStart));
+						res.append(text, i, nameEnd - i);
+						i = nameEnd;
+					} else if(isSpace(text[i])) {
+						std::size_t end = skipSpaces(text, i);
+						//the run may follow a removed comment.
+						if(res.empty() || !isSpace(res.back()))
+							res += text.find('\n', i) < end ? '\n' : ' ';
+						else if(text.find('\n', i) < end)
+							res.back() = '\n';
+						i = end;
+					} else {
+						res += text[i];
+						++i;
+					}
+				}
+				return res;
+			}
+
+			static bool isSpace(char c) {
+				return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f';
+			}
+
+			static std::size_t skipSpaces(const std::string& text, std::size_t i) {
+				while(i < text.size() && isSpace(text[i]))
+					++i;
+				return i;
+			}
+
+			static bool isRawElement(const std::string& name) {
+				return name == "pre" || name == "textarea" || name == "script" || name == "style";
+			}
+
+			static bool isConditionalComment(const std::string& text, std::size_t i) {
+				return text.compare(i, 7, "<!--[if") == 0 || text.compare(i, 13, "<!--<![endif]") == 0;
+			}
+
+			static std::string toLower(std::string s) {
+				for(char& c : s)
+					c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+				return s;
+			}
+
+			/**
+			* Position of the closing tag of element, or the size of the text.
+			*/
+			static std::size_t findClosingTag(const std::string& text, std::size_t i, const std::string& element) {
+				for(i = text.find("</", i); i != std::string::npos; i = text.find("</", i + 2)) {
+					if(toLower(text.substr(i + 2, element.size())) == element)
+						return i;
+				}
+				return text.size();
+			}
+
+			PartialIndices* m_partialIndices;
+			Report m_report;
+			//dependencies of the template being minified.
+			const Dependencies* m_source = nullptr;
+			std::map<std::pair<const std::list<Node>*, State>, Variant> m_variants;
+			std::map<std::string, const Variant*> m_variantsByName;
+			std::map<std::string, int> m_variantCounts;
+		};
+	}
+}
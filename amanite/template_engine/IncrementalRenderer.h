@@ -0,0 +1,294 @@
+#pragma once
+
+#include <string>
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+#include <sstream>
+#include <iterator>
+
+#include "CompiledTemplate.h"
+#include "Renderer.h"
+#include "Node.h"
+
+namespace amanite {
+	namespace template_engine {
+
+		/**
+		* Render a template once, then re-render only the parts of the output that depend on changed context values.
+		*
+		* The template is split into regions, one per top level node (sections and scopes are kept with their
+		* "endScope" node). While a region is rendered, every value it reads is recorded with its path from the
+		* root context. When a new context is given, a region is re-rendered only if one of these values changed.
+		* Regions containing code nodes are always re-rendered, since scripts may read anything. So are regions
+		* reading values that can not be reached from the root context.
+		*
+		* The renderer must not use a fragment cache, since cached sections do not read their content.
+		*/
+		template <class Context>
+		class IncrementalRenderer : private Renderer<Context>::AccessObserver {
+		public:
+			/**
+			* Replace length bytes at offset in the previous document by content.
+			* Patches are sorted by offset, and offsets refer to the previous document.
+			*/
+			struct Patch {
+				std::size_t offset;
+				std::size_t length;
+				std::string content;
+			};
+
+		private:
+			struct Segment {
+				std::string key;
+				std::size_t index;
+				bool isIndex;
+
+				bool operator<(const Segment& other) const {
+					if(isIndex != other.isIndex)
+						return isIndex < other.isIndex;
+					return isIndex ? index < other.index : key < other.key;
+				}
+			};
+			typedef std::vector<Segment> Path;
+
+			struct Region {
+				CompiledTemplate tmpl;
+				//the region contains code nodes, it is always re-rendered.
+				bool hasCode = false;
+				//the region is re-rendered at every update, for code nodes or values it read out of the root context.
+				bool untracked = false;
+				//values read by the region, with a fingerprint of what has been read from them.
+				std::map<Path, std::string> reads;
+				std::string output;
+			};
+
+			Renderer<Context> m_renderer;
+			std::vector<Region> m_regions;
+			std::string m_document;
+
+			//paths of the contexts reached while rendering the current region.
+			std::map<const Context*, Path> m_paths;
+			Region* m_currentRegion = nullptr;
+
+		public:
+			explicit IncrementalRenderer(const CompiledTemplate& tmpl) {
+				splitRegions(tmpl);
+				m_renderer.setAccessObserver(this);
+			}
+
+			IncrementalRenderer(const IncrementalRenderer&) = delete;
+			IncrementalRenderer& operator=(const IncrementalRenderer&) = delete;
+
+			/**
+			* Full rendering, recording the dependencies of every region.
+			*/
+			void render(const Context& c, std::ostream& os) {
+				m_document.clear();
+				for(auto& region : m_regions) {
+					renderRegion(c, region);
+					m_document += region.output;
+				}
+				os << m_document;
+			}
+
+			/**
+			* Re-render the regions affected by the changes in c, and return the corresponding patches.
+			*/
+			std::vector<Patch> update(const Context& c) {
+				std::vector<Patch> patches;
+				std::map<const Context*, std::vector<const Context*>> arrays;
+				std::size_t offset = 0;
+				for(auto& region : m_regions) {
+					std::size_t length = region.output.size();
+					if(isDirty(c, region, arrays)) {
+						std::string previous = std::move(region.output);
+						renderRegion(c, region);
+						if(previous != region.output)
+							patches.push_back({offset, length, region.output});
+						//rendering may have rebuilt the items of the arrays.
+						arrays.clear();
+					}
+					offset += length;
+				}
+
+				//patches offsets refer to the previous document, so they are applied from the last one.
+				for(auto patch = patches.rbegin(); patch != patches.rend(); ++patch)
+					m_document.replace(patch->offset, patch->length, patch->content);
+				return patches;
+			}
+
+			/**
+			* Re-render the regions affected by the changes in c, and write the full document to os.
+			*/
+			void update(const Context& c, std::ostream& os) {
+				update(c);
+				os << m_document;
+			}
+
+			const std::string& getDocument() const {
+				return m_document;
+			}
+
+			Renderer<Context>& getRenderer() {
+				return m_renderer;
+			}
+
+		private:
+			void splitRegions(const CompiledTemplate& tmpl) {
+				int depth = 0;
+				for(auto& node : tmpl.getNodes()) {
+					if(depth == 0) {
+						m_regions.emplace_back();
+						m_regions.back().tmpl.getDeps() = tmpl.getDeps();
+						m_regions.back().tmpl.getPartials() = tmpl.getPartials();
+					}
+					m_regions.back().tmpl.getNodes().push_back(node);
+					if(node.type == Node::Type::startScope || node.type == Node::Type::section)
+						++depth;
+					else if(node.type == Node::Type::endScope && depth > 0)
+						--depth;
+				}
+
+				for(auto& region : m_regions) {
+					std::set<std::string> visitedPartials;
+					region.hasCode = hasCode(region.tmpl.getNodes(), region.tmpl.getDeps(), visitedPartials);
+					region.untracked = region.hasCode;
+				}
+			}
+
+			static bool hasCode(const std::list<Node>& nodes, const Dependencies& deps, std::set<std::string>& visitedPartials) {
+				for(auto& node : nodes) {
+					if(node.type == Node::Type::code)
+						return true;
+					if(node.type == Node::Type::partial && visitedPartials.insert(node.value).second) {
+						auto dep = deps.find(node.value);
+						if(dep != deps.end() && hasCode(*dep->second, deps, visitedPartials))
+							return true;
+					}
+					if(hasCode(node.children, deps, visitedPartials))
+						return true;
+				}
+				return false;
+			}
+
+			void renderRegion(const Context& c, Region& region) {
+				region.reads.clear();
+				region.untracked = region.hasCode;
+				m_paths.clear();
+				m_paths[&c] = Path();
+				m_currentRegion = &region;
+
+				std::ostringstream os;
+				m_renderer.render(c, os, region.tmpl);
+				region.output = os.str();
+
+				m_currentRegion = nullptr;
+				m_paths.clear();
+			}
+
+			bool isDirty(const Context& c, const Region& region, std::map<const Context*, std::vector<const Context*>>& arrays) {
+				if(region.untracked)
+					return true;
+				for(auto& read : region.reads) {
+					const Context* value = resolve(c, read.first, arrays);
+					if(value == nullptr || fingerprint(*value, arrays, isPrinted(read.second)) != read.second)
+						return true;
+				}
+				return false;
+			}
+
+			/**
+			* Find the value at path in c, or nullptr if the path does not exist anymore.
+			*/
+			static const Context* resolve(const Context& c, const Path& path, std::map<const Context*, std::vector<const Context*>>& arrays) {
+				const Context* res = &c;
+				for(auto& segment : path) {
+					if(!segment.isIndex) {
+						res = &res->get(segment.key);
+						continue;
+					}
+					if(!res->isArray())
+						return nullptr;
+					auto& items = getItems(*res, arrays);
+					if(segment.index >= items.size())
+						return nullptr;
+					res = items[segment.index];
+				}
+				return res;
+			}
+
+			/**
+			* Items of an array, fetched only once per update since getAsArray may rebuild them.
+			*/
+			static const std::vector<const Context*>& getItems(const Context& array, std::map<const Context*, std::vector<const Context*>>& arrays) {
+				auto items = arrays.find(&array);
+				if(items == arrays.end()) {
+					items = arrays.emplace(&array, std::vector<const Context*>()).first;
+					for(const Context& item : array.getAsArray())
+						items->second.push_back(&item);
+				}
+				return items->second;
+			}
+
+			/**
+			* What the renderer can read from a value : arrays are iterated, objects used as contexts, unless a var
+			* node prints them, which writes their whole content.
+			*/
+			static std::string fingerprint(const Context& value, std::map<const Context*, std::vector<const Context*>>& arrays, bool printed = false) {
+				if(printed && (value.isArray() || value.isObject())) {
+					const auto& text = value.getAsString();
+					return std::string(value.isArray() ? "pa" : "po").append(text.data(), text.size());
+				}
+				if(value.isArray())
+					return "a" + std::to_string(getItems(value, arrays).size());
+				if(value.isObject())
+					return "o";
+				if(value.isNull())
+					return "n";
+				std::string res = value.isDouble() ? "d" : value.isBoolean() ? "b" : "s";
+				const auto& text = value.getAsString();
+				return res.append(text.data(), text.size());
+			}
+
+			void onGet(const Context& c, const std::string& key, const Context& value) override {
+				auto path = m_paths.find(&c);
+				if(path == m_paths.end()) {
+					//the value has not been reached from the root context, it can not be tracked.
+					m_currentRegion->untracked = true;
+					return;
+				}
+				Path valuePath = path->second;
+				valuePath.push_back({key, 0, false});
+				//the items are fetched again to render the array, so the fetched ones are not kept.
+				std::map<const Context*, std::vector<const Context*>> arrays;
+				m_currentRegion->reads[valuePath] = fingerprint(value, arrays);
+				m_paths[&value] = std::move(valuePath);
+			}
+
+			static bool isPrinted(const std::string& fingerprint) {
+				return !fingerprint.empty() && fingerprint[0] == 'p';
+			}
+
+			void onPrint(const Context& value) override {
+				if(!value.isArray() && !value.isObject())
+					return;
+				auto path = m_paths.find(&value);
+				if(path == m_paths.end())
+					return;
+				std::map<const Context*, std::vector<const Context*>> arrays;
+				m_currentRegion->reads[path->second] = fingerprint(value, arrays, true);
+			}
+
+			void onItem(const Context& array, std::size_t index, const Context& item) override {
+				auto path = m_paths.find(&array);
+				if(path == m_paths.end())
+					return;
+				Path itemPath = path->second;
+				itemPath.push_back({"", index, true});
+				m_paths[&item] = std::move(itemPath);
+			}
+		};
+	}
+}
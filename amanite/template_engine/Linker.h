@@ -0,0 +1,144 @@
+#pragma once
+
+#include <string>
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include "CompiledTemplate.h"
+#include "Node.h"
+
+namespace amanite {
+	namespace template_engine {
+
+		/**
+		* Resolves the partial nodes of a compiled template to their partials, in a table indexed by the indices the
+		* compiler gave them (see PartialIndices and CompiledTemplate::getPartials), so that the renderer does not
+		* look them up by name. It is meant to be run last, after the other passes, which unlink the templates they
+		* change.
+		*
+		* Linking fails with a std::runtime_error if a partial is missing, or if a partial includes itself
+		* outside of any section or condition, which could only be rendered forever. The table holds the shared
+		* partials of the dependencies : only the table belongs to the template. Partial nodes without an index
+		* are still looked up by name.
+		*/
+		class Linker {
+		private:
+			/**
+			* Linker configuration class.
+			*/
+			struct Configuration {
+				Configuration() :
+						dropUnusedPartials(true) {
+
+				}
+
+				//remove the partials the template does not use from its dependencies.
+				bool dropUnusedPartials;
+			};
+
+			Configuration m_configuration;
+
+		public:
+			Configuration& getConfiguration() {
+				return m_configuration;
+			}
+
+			const Configuration& getConfiguration() const {
+				return m_configuration;
+			}
+
+			/**
+			* Partial counts of a linked template.
+			*/
+			struct Report {
+				std::size_t linkedPartials = 0;
+				std::size_t droppedPartials = 0;
+			};
+
+			Report link(CompiledTemplate& tmpl) const {
+				const Dependencies& deps = static_cast<const CompiledTemplate&>(tmpl).getDeps();
+
+				//partials reached from the template, in the order they are reached.
+				std::vector<SharedNodes> partials;
+				std::vector<std::string> names;
+				std::set<std::string> reached;
+				collect(tmpl.getNodes(), deps, "the template", partials, names, reached);
+				for(std::size_t i = 0; i < names.size(); ++i)
+					collect(*deps.find(names[i])->second, deps, "the partial " + names[i], partials, names, reached);
+
+				std::map<std::string, int> states;
+				for(const auto& name : names)
+					checkRecursion(name, deps, states, {});
+
+				Dependencies linkedDeps;
+				for(const auto& name : names)
+					linkedDeps.insert(*deps.find(name));
+
+				Report report;
+				report.linkedPartials = names.size();
+				for(const auto& dep : deps) {
+					if(linkedDeps.find(dep.first) != linkedDeps.end())
+						continue;
+					if(getConfiguration().dropUnusedPartials)
+						++report.droppedPartials;
+					else
+						linkedDeps.insert(dep);
+				}
+				tmpl.getDeps() = std::move(linkedDeps);
+				tmpl.getPartials() = std::move(partials);
+				return report;
+			}
+
+		private:
+			static void collect(const std::list<Node>& nodes, const Dependencies& deps, const std::string& owner,
+					std::vector<SharedNodes>& partials, std::vector<std::string>& names, std::set<std::string>& reached) {
+				for(const Node& node : nodes) {
+					if(node.type == Node::Type::partial) {
+						auto dep = deps.find(node.value);
+						if(dep == deps.end())
+							throw std::runtime_error("Missing partial \"" + node.value + "\", included by " + owner + ".");
+						if(reached.insert(node.value).second)
+							names.push_back(node.value);
+						if(node.partialIndex >= 0) {
+							auto index = static_cast<std::size_t>(node.partialIndex);
+							if(index >= partials.size())
+								partials.resize(index + 1);
+							if(partials[index] != nullptr && partials[index] != dep->second)
+								throw std::logic_error("Partial index " + std::to_string(index) + " given to different partials.");
+							partials[index] = dep->second;
+						}
+					}
+					collect(node.children, deps, owner, partials, names, reached);
+				}
+			}
+
+			/**
+			* Follow the partials included outside of the sections and conditions, which are always rendered.
+			* states : 1 while the partial is being followed, 2 once it is known not to recurse.
+			*/
+			static void checkRecursion(const std::string& name, const Dependencies& deps, std::map<std::string, int>& states,
+					std::vector<std::string> path) {
+				int& state = states[name];
+				path.push_back(name);
+				if(state == 1) {
+					std::string cycle;
+					for(auto it = std::find(path.begin(), path.end(), name); it != path.end(); ++it)
+						cycle += (cycle.empty() ? "" : " > ") + *it;
+					throw std::runtime_error("Partial recursion cycle : " + cycle + ".");
+				}
+				if(state == 2)
+					return;
+				state = 1;
+				for(const Node& node : *deps.find(name)->second)
+					if(node.type == Node::Type::partial)
+						checkRecursion(node.value, deps, states, path);
+				state = 2;
+			}
+
+		};
+	}
+}
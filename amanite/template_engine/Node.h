@@ -4,9 +4,20 @@
 #include <list>
 #include <map>
 #include <deque>
+#include <memory>
+
+#include "Schema.h"
 
 namespace amanite {
 	namespace template_engine {
+		namespace expression {
+			struct Program;
+		}
+
+		namespace filter {
+			struct Chain;
+		}
+
 		struct Node {
 			enum Type {
 				root,
@@ -17,6 +28,8 @@ namespace amanite {
 				partial,
 				startScope,
 				endScope,
+				condition,
+				expression,
 			};
 
 			Node(Node::Type t, const std::string& v, const std::deque<std::string>& ts = {})
@@ -26,6 +39,18 @@ namespace amanite {
 			std::string value;
 			std::list<Node> children;
 			std::deque<std::string> tags;
+			//number of "parent." prefixes of the name of a var or section node : the context it is resolved against,
+			//counted from the current one. For condition and expression nodes, the largest one of their names.
+			int contextOffset = 0;
+			//compiled expression of a condition or expression node.
+			std::shared_ptr<const expression::Program> program;
+			//filters of a var node, null if it has none.
+			std::shared_ptr<const filter::Chain> filters;
+			//type of the value of a var or section node, declared by the schema given to the compiler.
+			schema::Type::Kind valueType = schema::Type::ANY;
+			//index of the partial of a partial node, given by the compiler (see PartialIndices), in the partials of its
+			//linked template (see Linker). -1 if it has none.
+			int partialIndex = -1;
 		};
 	}
 }
\ No newline at end of file
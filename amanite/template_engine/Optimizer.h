@@ -0,0 +1,189 @@
+#pragma once
+
+#include <string>
+#include <list>
+#include <map>
+#include <memory>
+#include <iterator>
+
+#include "CompiledTemplate.h"
+#include "Node.h"
+
+namespace amanite {
+	namespace template_engine {
+
+		/**
+		* Rewrites compiled templates into equivalent templates made of fewer, larger nodes.
+		* It is meant to be run between the compilation and the rendering steps.
+		*/
+		class Optimizer {
+		private:
+			/**
+			* Optimizer configuration class. Each pass can be enabled separately.
+			*/
+			struct Configuration {
+				Configuration() :
+						inlinePartials(true),
+						removeNoOpScopes(true),
+						dropEmptyNodes(true),
+						coalesceText(true),
+						inlineThreshold(8) {
+
+				}
+
+				bool inlinePartials;
+				bool removeNoOpScopes;
+				bool dropEmptyNodes;
+				bool coalesceText;
+				//partials made of at most inlineThreshold nodes are inlined.
+				std::size_t inlineThreshold;
+			};
+
+			Configuration m_configuration;
+
+		public:
+			Configuration& getConfiguration() {
+				return m_configuration;
+			}
+
+			const Configuration& getConfiguration() const {
+				return m_configuration;
+			}
+
+			/**
+			* Node counts of a template (partials included) before and after the optimization.
+			*/
+			struct Report {
+				std::size_t nodesBefore = 0;
+				std::size_t nodesAfter = 0;
+			};
+
+		private:
+			//optimized versions of the shared partials, so that they stay shared between the optimized templates.
+			//The original partial is kept alive so that its address can not be reused.
+			std::map<const std::list<Node>*, std::pair<SharedNodes, SharedNodes>> m_optimizedDeps;
+			//the nodes being optimized are those of an inlined partial, whose partial nodes are not inlined.
+			bool m_inlining = false;
+
+		public:
+			Report optimize(CompiledTemplate& tmpl) {
+				Report report;
+				report.nodesBefore = countNodes(tmpl);
+				tmpl.unlink();
+
+				optimize(tmpl.getNodes(), tmpl.getDeps());
+
+				Dependencies optimizedDeps;
+				for(auto& dep : tmpl.getDeps()) {
+					auto optimized = m_optimizedDeps.find(dep.second.get());
+					if(optimized == m_optimizedDeps.end()) {
+						std::list<Node> nodes = *dep.second;
+						optimize(nodes, tmpl.getDeps());
+						optimized = m_optimizedDeps.emplace(dep.second.get(),
+								std::make_pair(dep.second, std::make_shared<const std::list<Node>>(std::move(nodes)))).first;
+					}
+					optimizedDeps[dep.first] = optimized->second.second;
+				}
+				tmpl.getDeps() = std::move(optimizedDeps);
+
+				report.nodesAfter = countNodes(tmpl);
+				return report;
+			}
+
+			static std::size_t countNodes(const CompiledTemplate& tmpl) {
+				std::size_t res = countNodes(tmpl.getNodes());
+				for(auto& dep : tmpl.getDeps())
+					res += countNodes(*dep.second);
+				return res;
+			}
+
+			static std::size_t countNodes(const std::list<Node>& nodes) {
+				std::size_t res = nodes.size();
+				for(auto& node : nodes)
+					res += countNodes(node.children);
+				return res;
+			}
+
+		private:
+			/**
+			* Run the enabled passes over a list of nodes. Partials are inlined from the unoptimized dependencies
+			* and only one level deep : the partial nodes of the inlined nodes are kept, so that a partial including
+			* itself, even inside a section, is inlined once.
+			*/
+			void optimize(std::list<Node>& nodes, const Dependencies& deps) {
+				const Configuration& config = getConfiguration();
+				for(auto it = nodes.begin(); it != nodes.end();) {
+					if(config.inlinePartials && !m_inlining && it->type == Node::Type::partial) {
+						auto dep = deps.find(it->value);
+						if(dep != deps.end() && countNodes(*dep->second) <= config.inlineThreshold) {
+							std::list<Node> inlined = *dep->second;
+							m_inlining = true;
+							optimize(inlined, deps);
+							m_inlining = false;
+							nodes.splice(it, inlined);
+							it = nodes.erase(it);
+							continue;
+						}
+					}
+					optimize(it->children, deps);
+					++it;
+				}
+				if(config.removeNoOpScopes)
+					removeNoOpScopes(nodes);
+				if(config.dropEmptyNodes)
+					dropEmptyNodes(nodes);
+				if(config.coalesceText)
+					coalesceText(nodes);
+			}
+
+			/**
+			* A scope is a no-op if it does not set any tag, or if there is nothing in it.
+			* The "endScope" node following a section belongs to the section and is never removed.
+			*/
+			void removeNoOpScopes(std::list<Node>& nodes) {
+				for(auto it = nodes.begin(); it != nodes.end();) {
+					if(it->type == Node::Type::startScope) {
+						auto end = findEndScope(it, nodes.end());
+						if(end != nodes.end() && (it->tags.empty() || std::next(it) == end)) {
+							nodes.erase(end);
+							it = nodes.erase(it);
+							continue;
+						}
+					}
+					++it;
+				}
+			}
+
+			static std::list<Node>::iterator findEndScope(std::list<Node>::iterator start, std::list<Node>::iterator end) {
+				int depth = 0;
+				for(auto it = start; it != end; ++it) {
+					if(it->type == Node::Type::startScope || it->type == Node::Type::section) {
+						++depth;
+					} else if(it->type == Node::Type::endScope) {
+						if(--depth == 0)
+							return it;
+					}
+				}
+				return end;
+			}
+
+			void dropEmptyNodes(std::list<Node>& nodes) {
+				nodes.remove_if([](const Node& node) {
+					return node.type == Node::Type::text && node.value.empty();
+				});
+			}
+
+			void coalesceText(std::list<Node>& nodes) {
+				for(auto it = nodes.begin(); it != nodes.end();) {
+					auto next = std::next(it);
+					if(next != nodes.end() && it->type == Node::Type::text && next->type == Node::Type::text) {
+						it->value += next->value;
+						nodes.erase(next);
+					} else {
+						it = next;
+					}
+				}
+			}
+		};
+	}
+}
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <string>
+#include <list>
+#include <set>
+#include <deque>
+#include <iterator>
+#include <algorithm>
+#include <sstream>
+
+#include "EngineStateStack.h"
+#include "CompiledTemplate.h"
+#include "Renderer.h"
+#include "Expression.h"
+#include "Filter.h"
+#include "Node.h"
+
+namespace amanite {
+	namespace template_engine {
+
+		/**
+		* Specialize a compiled template against a partially known context.
+		*
+		* The keys of the static context are considered identical for every rendering : variables reading them
+		* are replaced by text, and sections bound to them are folded (dropped, inlined or unrolled).
+		* Everything reachable from a static key is static too. Keys that are absent from the static context
+		* are request specific : the nodes reading them are kept, and will be evaluated against the context
+		* given to the renderer. A kept section is kept with its whole content, so the context given to the
+		* renderer must provide everything that this content reads, including through "parent".
+		*
+		* Context must provide, in addition to what the Renderer needs, a "has(key)" method.
+		*/
+		template <class Context>
+		class PartialEvaluator {
+			const Context* m_staticContext = nullptr;
+			const Dependencies* m_deps = nullptr;
+			std::set<std::string> m_expandingPartials;
+			EngineStateStack m_engineStateStack;
+			filter::Buffer m_filterBuffer;
+
+		public:
+			CompiledTemplate specialize(const CompiledTemplate& tmpl, const Context& staticContext) {
+				m_staticContext = &staticContext;
+				m_deps = &tmpl.getDeps();
+				m_engineStateStack = EngineStateStack();
+
+				CompiledTemplate res;
+				res.getNodes() = specialize(tmpl.getNodes(), staticContext);
+				//partials that could not be inlined are still referenced.
+				res.getDeps() = tmpl.getDeps();
+				res.getPartials() = tmpl.getPartials();
+				return res;
+			}
+
+		private:
+			std::list<Node> specialize(const std::list<Node>& nodes, const Context& c) {
+				std::list<Node> res;
+				for(auto it = nodes.begin(); it != nodes.end(); ++it) {
+					const Node& item = *it;
+					switch(item.type) {
+						case Node::Type::var:
+							specializeVariable(item, c, res);
+							break;
+						case Node::Type::section: {
+							//the compiler always emits the "endScope" node of a section right after it.
+							auto endScope = std::next(it);
+							if(!specializeSection(item, c, res)) {
+								if(endScope != nodes.end() && endScope->type == Node::Type::endScope)
+									it = endScope;
+								m_engineStateStack.popState();
+							}
+							break;
+						}
+						case Node::Type::partial:
+							specializePartial(item, c, res);
+							break;
+						case Node::Type::startScope:
+							m_engineStateStack.pushState();
+							m_engineStateStack.applyTags(item.tags);
+							res.push_back(item);
+							break;
+						case Node::Type::endScope:
+							m_engineStateStack.popState();
+							res.push_back(item);
+							break;
+						default:
+							//text, code, condition and expression nodes are kept as is.
+							res.push_back(item);
+					}
+				}
+				return res;
+			}
+
+			void specializeVariable(const Node& node, const Context& c, std::list<Node>& res) {
+				m_engineStateStack.pushState();
+				m_engineStateStack.applyTags(node.tags);
+				const Context* value = lookup(c, node);
+				if(value == nullptr) {
+					res.push_back(node);
+				} else if(m_engineStateStack.getCurrentState().skipText) {
+					//variables are rendered even if text is skipped.
+					res.push_back({Node::Type::startScope, "", {"!skipText"}});
+					res.push_back({Node::Type::text, getText(node, *value)});
+					res.push_back({Node::Type::endScope, ""});
+				} else {
+					res.push_back({Node::Type::text, getText(node, *value)});
+				}
+				m_engineStateStack.popState();
+			}
+
+			/**
+			* Return false if the section, and the "endScope" node that follows it, has to be dropped.
+			* The state pushed by the section is popped by the caller in that case.
+			*/
+			bool specializeSection(const Node& node, const Context& c, std::list<Node>& res) {
+				m_engineStateStack.pushState();
+				m_engineStateStack.applyTags(node.tags);
+				const Context* currentContext = resolveContext(c, node.contextOffset);
+				const Context* value = currentContext == nullptr ? nullptr : lookup(c, node);
+				if(value == nullptr) {
+					res.push_back(node);
+					return true;
+				}
+
+				//the children of a folded section are rendered in the state pushed by the section.
+				Node scope(Node::Type::startScope, node.value, node.tags);
+				if(value->isArray()) {
+					auto& items = value->getAsArray();
+					if(items.empty())
+						return false;
+					std::list<Node> unrolled;
+					for(const Context& item : items) {
+						std::list<Node> children = specialize(node.children, item);
+						if(!isContextFree(children)) {
+							res.push_back(node);
+							return true;
+						}
+						unrolled.splice(unrolled.end(), children);
+					}
+					res.push_back(scope);
+					res.splice(res.end(), unrolled);
+				} else if(value->isObject()) {
+					std::list<Node> children = specialize(node.children, *value);
+					if(!isContextFree(children)) {
+						res.push_back(node);
+						return true;
+					}
+					res.push_back(scope);
+					res.splice(res.end(), children);
+				} else if(Renderer<Context>::isTruthy(*value)) {
+					std::list<Node> children = specialize(node.children, *currentContext);
+					//children rendered in a parent context can only be inlined if they do not read the context anymore.
+					if(currentContext != &c && !isContextFree(children)) {
+						res.push_back(node);
+						return true;
+					}
+					res.push_back(scope);
+					res.splice(res.end(), children);
+				} else {
+					return false;
+				}
+				return true;
+			}
+
+			void specializePartial(const Node& node, const Context& c, std::list<Node>& res) {
+				auto dep = m_deps->find(node.value);
+				if(dep == m_deps->end() || m_expandingPartials.find(node.value) != m_expandingPartials.end()) {
+					res.push_back(node);
+					return;
+				}
+				m_expandingPartials.insert(node.value);
+				res.splice(res.end(), specialize(*dep->second, c));
+				m_expandingPartials.erase(node.value);
+			}
+
+			/**
+			* Resolve the context contextOffset levels above c.
+			* Return nullptr if it is not known statically.
+			*/
+			const Context* resolveContext(const Context& c, int contextOffset) {
+				const Context* currentContext = &c;
+				for(int i = 0; i < contextOffset; ++i) {
+					if(currentContext == m_staticContext || !currentContext->hasParent())
+						return nullptr;
+					currentContext = &currentContext->getParentContext();
+				}
+				return currentContext;
+			}
+
+			/**
+			* Return the value read by node if it is static, or nullptr otherwise.
+			*/
+			const Context* lookup(const Context& c, const Node& node) {
+				const Context* currentContext = resolveContext(c, node.contextOffset);
+				if(currentContext == nullptr)
+					return nullptr;
+				if(currentContext == m_staticContext && !currentContext->has(node.value))
+					return nullptr;
+				return &currentContext->get(node.value);
+			}
+
+			std::string getText(const Node& node, const Context& value) {
+				if(node.filters != nullptr) {
+					std::ostringstream os;
+					expression::Value filterValue;
+					expression::load(value, filterValue);
+					node.filters->apply(filterValue, os, m_filterBuffer);
+					return os.str();
+				}
+				//adapters may return views rather than strings.
+				const auto& text = value.getAsString();
+				return std::string(text.data(), text.size());
+			}
+
+			static bool isContextFree(const std::list<Node>& nodes) {
+				return std::all_of(nodes.begin(), nodes.end(), [](const Node& node) {
+					return node.type == Node::Type::text
+							|| node.type == Node::Type::startScope
+							|| node.type == Node::Type::endScope;
+				});
+			}
+		};
+	}
+}
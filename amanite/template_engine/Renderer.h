@@ -4,43 +4,76 @@
 #include <list>
 #include <stack>
 #include <map>
+#include <vector>
 #include <istream>
 #include <fstream>
 #include <sstream>
 #include <type_traits>
+#include <functional>
+#include <utility>
 
 #include "EngineStateStack.h"
 
 #include <boost/filesystem.hpp>
-#include <chaiscript/utility/utility.hpp>
-#include "scriptEngine.h"
+#ifndef AMANITE_NO_SCRIPTING
+#include "amanite/script/ScriptEngine.h"
+#endif
 #include "Node.h"
+#include "Cancellation.h"
+#include "CompiledTemplate.h"
+#include "Expression.h"
+#include "Filter.h"
+#include "FragmentCache.h"
+#include "StaticTextSink.h"
 
 namespace amanite {
 	namespace template_engine {
-		class CompiledTemplate;
 
 		template <class Context>
 		class Renderer {
+#ifndef AMANITE_NO_SCRIPTING
 			script::ScriptEngine m_scriptingEngine;
+#endif
 
 			/***********************/
 			/* Main rendering code */
 			/***********************/
 
 		public:
+			/**
+			* Source of the items of a section, called with the context of the section and a function rendering one item.
+			* Unlike the items returned by getAsArray, each item only has to live until the function returns.
+			*/
+			typedef std::function<void(const Context&, const std::function<void(const Context&)>&)> SectionStream;
+
 			void render(const Context& c, std::ostream& os, const CompiledTemplate& tmpl, const Context* parentContext = nullptr) {
-				render(c, os, tmpl.getNodes(), tmpl.getDeps(), parentContext);
+				m_staticTextSink = dynamic_cast<StaticTextSink*>(os.rdbuf());
+				m_partials = &tmpl.getPartials();
+				//the script engine is only built for the templates that run code.
+				m_bindingScripts = m_scriptBinding && tmpl.hasCode();
+				m_frames.clear();
+				pushFrames(c);
+				try {
+					render(c, os, tmpl.getNodes(), tmpl.getDeps(), parentContext);
+				} catch(...) {
+					//the scopes of the nodes left unfinished are still open.
+					m_engineStateStack = EngineStateStack();
+					throw;
+				}
 			}
 
 
 		private:
-			void render(const Context& c, std::ostream& os, const std::list<Node>& tmpl, const std::map<std::string, std::list<Node>>& deps, const Context* parentContext = nullptr) {
-				m_scriptingEngine.add(chaiscript::var(&os), "out");
-				m_scriptingEngine.registerVariable(c, "context");
+			void render(const Context& c, std::ostream& os, const std::list<Node>& tmpl, const Dependencies& deps, const Context* parentContext = nullptr) {
+#ifndef AMANITE_NO_SCRIPTING
+				if(m_bindingScripts) {
+					m_scriptingEngine.bindOutput(os);
+					m_scriptingEngine.bindVariable(c, "context");
 
-				if(parentContext != nullptr)
-					m_scriptingEngine.registerVariable(*parentContext, "parentContext");
+					if(parentContext != nullptr)
+						m_scriptingEngine.bindVariable(*parentContext, "parentContext");
+				}
+#endif
 
 
 				std::for_each(tmpl.begin(), tmpl.end(), [&](const Node& item) {
@@ -55,10 +88,24 @@ namespace amanite {
 							renderSection(c, item, os, deps, parentContext);
 							break;
 						case Node::Type::partial:
-							render(c, os, deps.find(item.value)->second, deps, parentContext);
+							renderPartial(c, item, os, deps, parentContext);
 							break;
 						case Node::Type::code:
+#ifndef AMANITE_NO_SCRIPTING
+							//a script can not be interrupted : the cancellation is checked before and after it.
+							checkCancellation("code");
 							m_scriptingEngine.eval(item.value);
+							checkCancellation("code");
+#else
+							throw std::logic_error("Code nodes can not be rendered without scripting");
+#endif
+							break;
+						case Node::Type::condition:
+							if(evaluate(item).isTruthy())
+								render(c, os, item.children, deps, parentContext);
+							break;
+						case Node::Type::expression:
+							evaluate(item).write(os);
 							break;
 						case Node::Type::endScope:
 							m_engineStateStack.popState();
@@ -74,80 +121,414 @@ namespace amanite {
 				});
 			}
 
-			void renderText(const Context& c, const Node& node, std::ostream& os, const std::map<std::string, std::list<Node>>& deps, const Context* parentContext){
-				if(!m_engineStateStack.getCurrentState().skipText)
+			void renderText(const Context& c, const Node& node, std::ostream& os, const Dependencies& deps, const Context* parentContext){
+				if(m_engineStateStack.getCurrentState().skipText)
+					return;
+				//cached sections are rendered into other streams, which receive the text.
+				if(m_staticTextSink != nullptr && os.rdbuf() == m_staticTextSink)
+					m_staticTextSink->writeText(node);
+				else
 					os << node.value;
 			}
 
-			void renderVariable(const Context& c, const Node& node, std::ostream& os, const std::map<std::string, std::list<Node>>& deps, const Context* parentContext){
+			void renderVariable(const Context& c, const Node& node, std::ostream& os, const Dependencies& deps, const Context* parentContext){
 				m_engineStateStack.pushState();
 				m_engineStateStack.applyTags(node.tags);
-				const Context* currentContext = &c;
-				for(int i = 0; i < m_engineStateStack.getCurrentState().contextOffset; ++i) {
-					if(!currentContext->hasParent()) {
-						throw std::runtime_error("Context does not have parents");
-					}
-					currentContext = &currentContext->getParentContext();
-				}
+				const Context& currentContext = *m_frames[getFrame(node.contextOffset)];
 
 				//TODO : escape characters if m_engineStateStack.getCurrentState().escape is set to true.
-				os << currentContext->get(node.value).getAsString();
+				const Context& value = lookup(currentContext, node.value);
+				if(m_accessObserver != nullptr)
+					m_accessObserver->onPrint(value);
+				if(node.filters == nullptr) {
+					os << value.getAsString();
+				} else {
+					loadVariable(value, node, m_filterValue);
+					node.filters->apply(m_filterValue, os, m_filterBuffer);
+				}
 				m_engineStateStack.popState();
 			}
 
-			void renderSection(const Context& c, const Node& node, std::ostream& os, const std::map<std::string, std::list<Node>>& deps, const Context* parentContext){
+			void renderSection(const Context& c, const Node& node, std::ostream& os, const Dependencies& deps, const Context* parentContext){
 				//reduce scope of variable secItems to the local case to avoid compiler error.
 				m_engineStateStack.pushState();
 				m_engineStateStack.applyTags(node.tags);
-				const Context* currentContext = &c;
-				for(int i = 0; i < m_engineStateStack.getCurrentState().contextOffset; ++i) {
-					if(!currentContext->hasParent()) {
-						throw std::runtime_error("Context does not have parents");
+				std::size_t frame = getFrame(node.contextOffset);
+				const Context& currentContext = *m_frames[frame];
+
+				//the section is rendered as a child of the context it is resolved against : the frames above it are
+				//hidden until it is rendered.
+				std::vector<const Context*> hiddenFrames(m_frames.begin() + frame + 1, m_frames.end());
+				m_frames.resize(frame + 1);
+
+				auto stream = m_sectionStreams.find(node.value);
+				int parentReads = -1;
+				if(stream == m_sectionStreams.end() && m_fragmentCache != nullptr
+						&& (m_engineStateStack.getCurrentState().cache || m_fragmentCache->getConfiguration().cacheAllSections))
+					parentReads = m_fragmentCache->getParentReads(node, deps);
+
+				try {
+					if(stream != m_sectionStreams.end()) {
+						renderStreamedSection(currentContext, node, os, deps, stream->second);
+					} else if(parentReads >= 0) {
+						renderCachedSection(currentContext, node, os, deps, parentReads);
+					} else {
+						renderSectionContent(currentContext, node, os, deps);
 					}
-					currentContext = &currentContext->getParentContext();
+				} catch(RenderCancelled& e) {
+					e.enter(node.value);
+					throw;
+				}
+
+				m_frames.insert(m_frames.end(), hiddenFrames.begin(), hiddenFrames.end());
+			}
+
+			void renderSectionContent(const Context& c, const Node& node, std::ostream& os, const Dependencies& deps){
+				const Context& value = lookup(c, node.value);
+				//a section specialized by the schema only checks the declared type, then falls back to the dispatch.
+				switch(node.valueType) {
+					case schema::Type::ARRAY:
+						if(value.isArray())
+							return renderItems(c, value, node, os, deps);
+						break;
+					case schema::Type::OBJECT:
+						if(value.isObject())
+							return renderObject(c, value, node, os, deps);
+						break;
+					case schema::Type::BOOLEAN:
+						if(value.isBoolean()) {
+							if(value.getAsBoolean())
+								render(c, os, node.children, deps, &c);
+							return;
+						}
+						break;
+					case schema::Type::NUMBER:
+						if(value.isDouble()) {
+							if(value.getAsDouble() > 0)
+								render(c, os, node.children, deps, &c);
+							return;
+						}
+						break;
+					case schema::Type::STRING:
+						if(value.isString()) {
+							if(value.getAsString().compare("yes") == 0)
+								render(c, os, node.children, deps, &c);
+							return;
+						}
+						break;
+					case schema::Type::NUL:
+						if(value.isNull())
+							return;
+						break;
+					default:
+						break;
 				}
 
-				if(currentContext->get(node.value).isArray()) {
-					auto& secItems = currentContext->get(node.value).getAsArray();
+				if(value.isArray()) {
+					renderItems(c, value, node, os, deps);
+				} else if(value.isObject()) {
+					renderObject(c, value, node, os, deps);
+				} else if(isTruthy(value)) {
+					render(c, os, node.children, deps, &c);
+				}
+			}
+
+			void renderItems(const Context& c, const Context& value, const Node& node, std::ostream& os, const Dependencies& deps){
+				const auto& secItems = value.getAsArray();
+				std::size_t index = 0;
+				//the items are children of the array.
+				m_frames.push_back(&value);
+				try {
 					std::for_each(std::begin(secItems), std::end(secItems), [&](const Context& secIt) {
-						render(secIt, os, node.children, deps, currentContext);
+						checkCancellation();
+						if(m_accessObserver != nullptr)
+							m_accessObserver->onItem(value, index, secIt);
+						m_frames.push_back(&secIt);
+						render(secIt, os, node.children, deps, &c);
+						m_frames.pop_back();
+						++index;
+					});
+				} catch(RenderCancelled& e) {
+					e.enter("[" + std::to_string(index) + "]");
+					throw;
+				}
+				m_frames.pop_back();
+			}
+
+			void renderObject(const Context& c, const Context& value, const Node& node, std::ostream& os, const Dependencies& deps){
+				m_frames.push_back(&value);
+				render(value, os, node.children, deps, &c);
+				m_frames.pop_back();
+			}
+
+			/**
+			* The items are rendered as they are produced by the stream, with the context of the section as parent.
+			*/
+			void renderStreamedSection(const Context& c, const Node& node, std::ostream& os, const Dependencies& deps, const SectionStream& stream){
+				std::size_t index = 0;
+				try {
+					stream(c, [&](const Context& item) {
+						checkCancellation();
+						m_frames.push_back(&item);
+						render(item, os, node.children, deps, &c);
+						m_frames.pop_back();
+						++index;
 					});
-				} else if(currentContext->get(node.value).isObject()) {
-					render(currentContext->get(node.value), os, node.children, deps, currentContext);
+				} catch(RenderCancelled& e) {
+					e.enter("[" + std::to_string(index) + "]");
+					throw;
+				}
+			}
+
+			void renderCachedSection(const Context& c, const Node& node, std::ostream& os, const Dependencies& deps, int parentReads){
+				const Context& value = lookup(c, node.value);
+				FragmentCache::Key key;
+				key.node = &node;
+				key.skipText = m_engineStateStack.getCurrentState().skipText;
+				key.identities.push_back(value.getIdentity());
+
+				//the content of a section bound to a scalar value is rendered in the context of the section.
+				int readContexts = parentReads + (value.isArray() || value.isObject() ? 0 : 1);
+				for(int i = 0; i < readContexts && i < static_cast<int>(m_frames.size()); ++i)
+					key.identities.push_back(m_frames[m_frames.size() - 1 - i]->getIdentity());
+
+				if(m_fragmentCache->write(key, os))
+					return;
+
+				std::ostringstream fragment;
+				renderSectionContent(c, node, fragment, deps);
+#ifndef AMANITE_NO_SCRIPTING
+				//the content of the section rebound "out" to the fragment stream.
+				if(m_bindingScripts)
+					m_scriptingEngine.bindOutput(os);
+#endif
+				m_fragmentCache->insert(key, fragment.str());
+				os << fragment.str();
+			}
+
+			/**
+			* Context::get returns a reference for the adapters owning their children, a value for the adapters
+			* building them on the fly. The callers bind the result to a const reference in both cases.
+			*/
+			typedef decltype(std::declval<const Context&>().get(std::declval<const std::string&>())) Value;
+
+			Value lookup(const Context& c, const std::string& key){
+				Value value = c.get(key);
+				if(m_accessObserver != nullptr)
+					m_accessObserver->onGet(c, key, value);
+				return value;
+			}
+
+			void renderPartial(const Context& c, const Node& node, std::ostream& os, const Dependencies& deps, const Context* parentContext){
+				try {
+					checkCancellation();
+					render(c, os, getPartial(node, deps), deps, parentContext);
+				} catch(RenderCancelled& e) {
+					e.enter("partial " + node.value);
+					throw;
+				}
+			}
+
+			/**
+			* Throw a RenderCancelled if the render has to stop. step is the node about to be run, if it is not
+			* described by the callers.
+			*/
+			void checkCancellation(const char* step = nullptr) {
+				if(m_cancellation == nullptr)
+					return;
+				const char* reason = m_cancellation->check();
+				if(reason == nullptr)
+					return;
+				RenderCancelled e(reason);
+				if(step != nullptr)
+					e.enter(step);
+				throw e;
+			}
+
+			/**
+			* Nodes of the partial of a partial node : its index if the template is linked, else its name.
+			*/
+			const std::list<Node>& getPartial(const Node& node, const Dependencies& deps) {
+				if(node.partialIndex >= 0 && static_cast<std::size_t>(node.partialIndex) < m_partials->size()
+						&& (*m_partials)[node.partialIndex] != nullptr)
+					return *(*m_partials)[node.partialIndex];
+				auto dep = deps.find(node.value);
+				if(dep == deps.end())
+					throw std::runtime_error("Missing partial \"" + node.value + "\".");
+				return *dep->second;
+			}
+
+			/**
+			* Load the value of a var node, without testing the other types if it has the one declared by the schema.
+			*/
+			void loadVariable(const Context& value, const Node& node, expression::Value& res) {
+				switch(node.valueType) {
+					case schema::Type::STRING:
+						if(value.isString())
+							return res.setString(value.getAsString());
+						break;
+					case schema::Type::NUMBER:
+						if(value.isDouble())
+							return res.setNumber(value.getAsDouble());
+						break;
+					case schema::Type::BOOLEAN:
+						if(value.isBoolean())
+							return res.setBoolean(value.getAsBoolean());
+						break;
+					default:
+						break;
+				}
+				expression::load(value, res);
+			}
+
+			/**
+			* Run the program of a condition or expression node.
+			*/
+			const expression::Value& evaluate(const Node& node) {
+				return m_machine.run(*node.program, [this](const expression::Path& path, expression::Value& res) {
+					loadPath(*m_frames[getFrame(path.contextOffset)], path, 0, res);
+				});
+			}
+
+			void loadPath(const Context& c, const expression::Path& path, std::size_t key, expression::Value& res) {
+				if(key < path.keys.size()) {
+					const Context& value = lookup(c, path.keys[key]);
+					loadPath(value, path, key + 1, res);
 				} else {
-					const Context& ctx = currentContext->get(node.value);
-					bool needRendering = false;
-					if(ctx.isDouble()){
-						//TODO : >0 or !=0 ?? The problem with !=0 is that itcannot be done rigorously for doubles...
-						needRendering = ctx.getAsDouble() > 0;
-					}else if(ctx.isBoolean()){
-						needRendering = ctx.getAsBoolean();
-					}else if(ctx.isString()){
-						const std::string& s = ctx.getAsString();
-						//todo : add "true", "oui", etc...
-						if(s.compare("yes") == 0){
-							needRendering = true;
-						}
-					}
-					if(needRendering) {
-						render(*currentContext, os, node.children, deps, currentContext);
+					expression::load(c, res);
+				}
+			}
+
+			/**
+			* The frames are the contexts the current one descends from, the current one being the last frame.
+			* They mirror the parents of the adapters, so that "parent." is an index in the frames rather than a
+			* walk up the parents.
+			*/
+			void pushFrames(const Context& c) {
+				if(c.hasParent())
+					pushFrames(c.getParentContext());
+				m_frames.push_back(&c);
+			}
+
+			/**
+			* Index of the frame contextOffset levels above the current context.
+			*/
+			std::size_t getFrame(int contextOffset) const {
+				if(contextOffset >= static_cast<int>(m_frames.size()))
+					throw std::runtime_error("Context does not have parents");
+				return m_frames.size() - 1 - contextOffset;
+			}
+
+		public:
+			/**
+			* Tell if a section bound to a value that is neither an array nor an object has to be rendered.
+			*/
+			static bool isTruthy(const Context& ctx) {
+				bool needRendering = false;
+				if(ctx.isDouble()){
+					//TODO : >0 or !=0 ?? The problem with !=0 is that itcannot be done rigorously for doubles...
+					needRendering = ctx.getAsDouble() > 0;
+				}else if(ctx.isBoolean()){
+					needRendering = ctx.getAsBoolean();
+				}else if(ctx.isString()){
+					const auto& s = ctx.getAsString();
+					//todo : add "true", "oui", etc...
+					if(s.compare("yes") == 0){
+						needRendering = true;
 					}
 				}
+				return needRendering;
+			}
+
+
+
+
+
+			/**
+			* Observer notified of every context access made while rendering.
+			*/
+			class AccessObserver {
+			public:
+				virtual ~AccessObserver() {}
+
+				/**
+				* value has been read from c with key.
+				*/
+				virtual void onGet(const Context& c, const std::string& key, const Context& value) = 0;
+
+				/**
+				* The item at index in array is about to be rendered.
+				*/
+				virtual void onItem(const Context& array, std::size_t index, const Context& item) = 0;
+
+				/**
+				* value, read just before, is printed by a var node.
+				*/
+				virtual void onPrint(const Context& value) {
+				}
+			};
+
+			void setAccessObserver(AccessObserver* observer) {
+				m_accessObserver = observer;
 			}
 
+			/**
+			* Use cache to memoize the output of sections. The cache may be shared by several renderers.
+			*/
+			void setFragmentCache(FragmentCache* cache) {
+				m_fragmentCache = cache;
+			}
+
+			FragmentCache* getFragmentCache() const {
+				return m_fragmentCache;
+			}
 
+			/**
+			* Render the sections named key from stream instead of the context. The stream is read once : a template
+			* rendering the section several times will only get the remaining items. Streamed sections are never cached.
+			*/
+			void setSectionStream(const std::string& key, SectionStream stream) {
+				m_sectionStreams[key] = std::move(stream);
+			}
 
+			void removeSectionStream(const std::string& key) {
+				m_sectionStreams.erase(key);
+			}
 
+			/**
+			* Stop the renders when cancellation is cancelled or past its deadline (see Cancellation), null to never
+			* stop them. Scripts can poll it with the function cancelled().
+			*/
+			void setCancellation(const Cancellation* cancellation) {
+				m_cancellation = cancellation;
+#ifndef AMANITE_NO_SCRIPTING
+				if(cancellation != nullptr)
+					m_scriptingEngine.setCancellationCheck([cancellation]() { return cancellation->check() != nullptr; });
+				else
+					m_scriptingEngine.setCancellationCheck(nullptr);
+#endif
+			}
 
 			/******************/
 			/* Scripting code */
 			/******************/
 		public:
+#ifndef AMANITE_NO_SCRIPTING
 			script::ScriptEngine& getScriptEngine() {
 				return m_scriptingEngine;
 			}
+#endif
+
+			/**
+			* The contexts and the output stream are bound to the script engine only when rendering a template with
+			* code nodes (see CompiledTemplate::hasCode). Disabling the binding stops it for every template.
+			*/
+			void setScriptBinding(bool enabled) {
+				m_scriptBinding = enabled;
+			}
 
 		private:
+#ifndef AMANITE_NO_SCRIPTING
 			void registerContext() {
 				m_scriptingEngine.registerClass<Context>("Context");
 				m_scriptingEngine.registerFunction(&Context::get, "get");
@@ -175,10 +556,26 @@ namespace amanite {
 			void registerVariable(T& v, const std::string& varName) {
 				registerVariable(v, varName);
 			}
+#endif
 
 
 		private:
 			EngineStateStack m_engineStateStack;
+			std::vector<const Context*> m_frames;
+			expression::Machine m_machine;
+			//value and output of the filters, kept between variables so that their strings keep their storage.
+			expression::Value m_filterValue;
+			filter::Buffer m_filterBuffer;
+			FragmentCache* m_fragmentCache = nullptr;
+			AccessObserver* m_accessObserver = nullptr;
+			std::map<std::string, SectionStream> m_sectionStreams;
+			bool m_scriptBinding = true;
+			//the template being rendered has code nodes, and the binding is enabled.
+			bool m_bindingScripts = false;
+			StaticTextSink* m_staticTextSink = nullptr;
+			//partials of the template being rendered, indexed by Node::partialIndex.
+			const std::vector<SharedNodes>* m_partials = nullptr;
+			const Cancellation* m_cancellation = nullptr;
 		};
 	}
 }
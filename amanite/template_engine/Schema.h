@@ -0,0 +1,109 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <memory>
+#include <stdexcept>
+
+namespace amanite {
+	namespace template_engine {
+		namespace schema {
+
+			/**
+			* Type of a context, described by a subset of JSON Schema : "type", "properties" and
+			* "additionalProperties" for objects, "items" for arrays. Anything else is ignored. A type without
+			* "type", or with several ones, may be of any type.
+			*
+			* Given to the Compiler, it specializes the section and var nodes for the types of their values (see
+			* Node::valueType). The renderer still checks the type of each value, and falls back to the generic
+			* rendering when it differs.
+			*/
+			struct Type {
+				enum Kind {
+					ANY,
+					NUL,
+					BOOLEAN,
+					NUMBER,
+					STRING,
+					ARRAY,
+					OBJECT
+				};
+
+				Kind kind = ANY;
+				std::map<std::string, std::shared_ptr<const Type>> properties;
+				//false if an object can only have the listed properties.
+				bool additionalProperties = true;
+				//type of the items of an array, null for any type.
+				std::shared_ptr<const Type> items;
+
+				/**
+				* Type of the member key of a value of this type, null if it is not known.
+				* Throw a std::invalid_argument if a value of this type can not have this member.
+				*/
+				const Type* getMember(const std::string& key) const {
+					if(kind == ANY)
+						return nullptr;
+					if(kind != OBJECT)
+						throw std::invalid_argument("Schema mismatch : \"" + key + "\" is read from " + getName(kind));
+					auto it = properties.find(key);
+					if(it != properties.end())
+						return it->second.get();
+					if(!additionalProperties)
+						throw std::invalid_argument("Schema mismatch : the object has no property \"" + key + "\"");
+					return nullptr;
+				}
+
+				static const char* getName(Kind kind) {
+					switch(kind) {
+						case NUL: return "null";
+						case BOOLEAN: return "a boolean";
+						case NUMBER: return "a number";
+						case STRING: return "a string";
+						case ARRAY: return "an array";
+						case OBJECT: return "an object";
+						default: return "any value";
+					}
+				}
+
+				/**
+				* Read a type from its JSON Schema description. json is a json11::Json, or any value with the same
+				* interface.
+				*/
+				template <class Json>
+				static std::shared_ptr<const Type> read(const Json& json) {
+					auto res = std::make_shared<Type>();
+					if(!json.is_object())
+						return res;
+					const Json& type = json["type"];
+					if(type.is_string())
+						res->kind = getKind(type.string_value());
+					for(const auto& property : json["properties"].object_items())
+						res->properties[property.first] = read(property.second);
+					const Json& additionalProperties = json["additionalProperties"];
+					if(additionalProperties.is_bool())
+						res->additionalProperties = additionalProperties.bool_value();
+					if(json["items"].is_object())
+						res->items = read(json["items"]);
+					return res;
+				}
+
+			private:
+				static Kind getKind(const std::string& name) {
+					if(name == "null")
+						return NUL;
+					if(name == "boolean")
+						return BOOLEAN;
+					if(name == "number" || name == "integer")
+						return NUMBER;
+					if(name == "string")
+						return STRING;
+					if(name == "array")
+						return ARRAY;
+					if(name == "object")
+						return OBJECT;
+					throw std::invalid_argument("Unknown schema type \"" + name + "\"");
+				}
+			};
+		}
+	}
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <streambuf>
+
+#include "Node.h"
+
+namespace amanite {
+	namespace template_engine {
+
+		/**
+		* Stream buffer receiving the text nodes themselves, rather than their text, when a template is rendered
+		* into a stream using it. It can then write data prepared for each node when the template was loaded.
+		* The other output is written to the stream buffer as usual, in order.
+		*/
+		class StaticTextSink : public std::streambuf {
+		public:
+			virtual ~StaticTextSink() {}
+
+			/**
+			* Write the text of node.
+			*/
+			virtual void writeText(const Node& node) = 0;
+		};
+	}
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+namespace amanite{
+	namespace tools {
+
+		/**
+		* Fixed set of worker threads running the same job together. run() gives each worker its index and
+		* returns once all of them are done, so the workers can keep per thread state between jobs.
+		*/
+		class ThreadPool {
+		public:
+			typedef std::function<void(std::size_t worker)> Job;
+
+			explicit ThreadPool(std::size_t threadCount) {
+				for(std::size_t i = 0; i < threadCount; ++i)
+					m_threads.emplace_back([this, i]() { work(i); });
+			}
+
+			~ThreadPool() {
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_stopping = true;
+				}
+				m_wakeUp.notify_all();
+				for(auto& thread : m_threads)
+					thread.join();
+			}
+
+			ThreadPool(const ThreadPool&) = delete;
+			ThreadPool& operator=(const ThreadPool&) = delete;
+
+			std::size_t size() const {
+				return m_threads.size();
+			}
+
+			/**
+			* Run job on every worker and wait for them. The first exception thrown by a worker is rethrown.
+			*/
+			void run(const Job& job) {
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_job = &job;
+				m_error = nullptr;
+				m_running = m_threads.size();
+				++m_generation;
+				m_wakeUp.notify_all();
+				m_done.wait(lock, [this]() { return m_running == 0; });
+				m_job = nullptr;
+				if(m_error != nullptr)
+					std::rethrow_exception(m_error);
+			}
+
+		private:
+			void work(std::size_t worker) {
+				std::size_t generation = 0;
+				for(;;) {
+					const Job* job;
+					{
+						std::unique_lock<std::mutex> lock(m_mutex);
+						m_wakeUp.wait(lock, [&]() { return m_stopping || m_generation != generation; });
+						if(m_stopping)
+							return;
+						generation = m_generation;
+						job = m_job;
+					}
+
+					std::exception_ptr error;
+					try {
+						(*job)(worker);
+					} catch(...) {
+						error = std::current_exception();
+					}
+
+					std::lock_guard<std::mutex> lock(m_mutex);
+					if(error != nullptr && m_error == nullptr)
+						m_error = error;
+					if(--m_running == 0)
+						m_done.notify_one();
+				}
+			}
+
+			std::vector<std::thread> m_threads;
+			std::mutex m_mutex;
+			std::condition_variable m_wakeUp;
+			std::condition_variable m_done;
+			const Job* m_job = nullptr;
+			std::exception_ptr m_error;
+			std::size_t m_running = 0;
+			std::size_t m_generation = 0;
+			bool m_stopping = false;
+		};
+	}
+}
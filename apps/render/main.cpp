@@ -0,0 +1,563 @@
+/**
+* amanite-render : render a template against a batch of JSON contexts.
+*
+* The templates are compiled once, then the contexts are rendered by several workers, either threads sharing the
+* compiled template, or processes forked from a warmed up ForkServer, each taking one shard of the contexts.
+* The throughput and the latencies of the renderings are written to the standard error at the end.
+*/
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <boost/filesystem.hpp>
+
+#include "amanite/template_engine/Compiler.h"
+#include "amanite/template_engine/Renderer.h"
+#include "amanite/template_engine/ForkServer.h"
+#include "amanite/contexts/json/JsonContextAdapter.h"
+#include "amanite/contexts/json/JsonStreamReader.h"
+#include "amanite/tools/ThreadPool.h"
+
+using namespace amanite::template_engine;
+using amanite::template_engine::context::JsonContextAdapter;
+using amanite::template_engine::context::JsonContextAdapterPool;
+using amanite::template_engine::context::JsonStreamReader;
+
+namespace {
+
+	const char* usage =
+		"usage : amanite-render -r ROOT [options]\n"
+		"  -t, --templates DIR   directory of the templates (default : current directory)\n"
+		"  -r, --root NAME       template to render\n"
+		"  -i, --input FILE      contexts as NDJSON or as a JSON array, - for the standard input (default)\n"
+		"  -d, --input-dir DIR   directory of .json files, each holding one or more contexts\n"
+		"  -f, --format F        auto, ndjson or array (default : auto)\n"
+		"  -o, --output DIR      write one file per context to DIR instead of the standard output\n"
+		"  -n, --name KEY        name the output files after the KEY member of the contexts\n"
+		"  -e, --extension EXT   extension of the output files (default : the one of the root template)\n"
+		"  -j, --jobs N          number of workers (default : 1)\n"
+		"  -p, --processes       fork the workers once the templates are compiled instead of starting threads\n"
+		"  -w, --window N        number of contexts read at once by the threads (default : 1024)\n"
+		"  -m, --minify          minify the HTML of the templates\n"
+		"  -q, --quiet           do not write the statistics\n"
+		"  -h, --help            show this help\n";
+
+	struct Options {
+		Options() :
+				input("-"),
+				format(JsonStreamReader::AUTO),
+				jobs(1),
+				processes(false),
+				windowSize(1024),
+				minify(false),
+				quiet(false) {
+
+		}
+
+		std::string templatePath;
+		std::string root;
+		std::string input;
+		std::string inputDirectory;
+		JsonStreamReader::Format format;
+		std::string outputDirectory;
+		std::string nameKey;
+		std::string extension;
+		std::size_t jobs;
+		bool processes;
+		std::size_t windowSize;
+		bool minify;
+		bool quiet;
+	};
+
+	std::size_t toCount(const std::string& option, const std::string& value) {
+		char* end = nullptr;
+		unsigned long res = std::strtoul(value.c_str(), &end, 10);
+		if(value.empty() || *end != '\0' || res == 0)
+			throw std::invalid_argument("The option " + option + " expects a positive number");
+		return static_cast<std::size_t>(res);
+	}
+
+	Options parseOptions(int argc, char** argv) {
+		Options res;
+		bool extension = false;
+		for(int i = 1; i < argc; ++i) {
+			std::string option = argv[i];
+			auto value = [&]() -> std::string {
+				if(i + 1 >= argc)
+					throw std::invalid_argument("The option " + option + " expects a value");
+				return argv[++i];
+			};
+			if(option == "-t" || option == "--templates") {
+				res.templatePath = value();
+			} else if(option == "-r" || option == "--root") {
+				res.root = value();
+			} else if(option == "-i" || option == "--input") {
+				res.input = value();
+			} else if(option == "-d" || option == "--input-dir") {
+				res.inputDirectory = value();
+			} else if(option == "-f" || option == "--format") {
+				std::string format = value();
+				if(format == "auto")
+					res.format = JsonStreamReader::AUTO;
+				else if(format == "ndjson")
+					res.format = JsonStreamReader::NDJSON;
+				else if(format == "array")
+					res.format = JsonStreamReader::ARRAY;
+				else
+					throw std::invalid_argument("Unknown format \"" + format + "\"");
+			} else if(option == "-o" || option == "--output") {
+				res.outputDirectory = value();
+			} else if(option == "-n" || option == "--name") {
+				res.nameKey = value();
+			} else if(option == "-e" || option == "--extension") {
+				res.extension = value();
+				extension = true;
+			} else if(option == "-j" || option == "--jobs") {
+				res.jobs = toCount(option, value());
+			} else if(option == "-p" || option == "--processes") {
+				res.processes = true;
+			} else if(option == "-w" || option == "--window") {
+				res.windowSize = toCount(option, value());
+			} else if(option == "-m" || option == "--minify") {
+				res.minify = true;
+			} else if(option == "-q" || option == "--quiet") {
+				res.quiet = true;
+			} else if(option == "-h" || option == "--help") {
+				std::cout << usage;
+				std::exit(0);
+			} else {
+				throw std::invalid_argument("Unknown option " + option);
+			}
+		}
+
+		if(res.root.empty())
+			throw std::invalid_argument("The root template is missing");
+		if(!extension)
+			res.extension = boost::filesystem::path(res.root).extension().string();
+		else if(!res.extension.empty() && res.extension[0] != '.')
+			res.extension = "." + res.extension;
+		if(res.processes && res.outputDirectory.empty())
+			throw std::invalid_argument("The processes write files, an output directory is needed");
+		if(res.processes && res.inputDirectory.empty() && res.input == "-")
+			throw std::invalid_argument("The processes read the input themselves, it can not be the standard input");
+		return res;
+	}
+
+	/**
+	* Contexts read one at a time from the input, restricted to one shard : the values of the stream whose index
+	* modulo shardCount is shard, or the files of the directory whose index is. The values of the other shards
+	* are passed without being parsed.
+	*/
+	class Source {
+	public:
+		Source(const Options& options, std::size_t shard = 0, std::size_t shardCount = 1)
+				: m_nameKey(options.nameKey), m_shard(shard), m_shardCount(shardCount) {
+			if(!options.inputDirectory.empty()) {
+				using namespace boost::filesystem;
+				std::vector<path> files;
+				for(directory_iterator it(options.inputDirectory); it != directory_iterator(); ++it) {
+					if(is_regular_file(it->status()) && it->path().extension() == ".json")
+						files.push_back(it->path());
+				}
+				std::sort(files.begin(), files.end());
+				for(std::size_t i = shard; i < files.size(); i += shardCount)
+					m_files.push_back(files[i]);
+				return;
+			}
+
+			std::istream* is = &std::cin;
+			if(options.input != "-") {
+				m_file.open(options.input, std::ios::binary);
+				if(!m_file)
+					throw std::invalid_argument("The file " + options.input + " can not be opened.");
+				is = &m_file;
+			}
+			m_reader.reset(new JsonStreamReader(*is, options.format));
+		}
+
+		/**
+		* Read the next context and the name of its output. Return false at the end of the input.
+		*/
+		bool next(json11::Json& value, std::string& name) {
+			if(m_reader != nullptr) {
+				if(!nextValue(value))
+					return false;
+				name = std::to_string(m_index++);
+			} else {
+				while(m_valueIndex == m_values.size()) {
+					if(m_fileIndex == m_files.size())
+						return false;
+					readFile(m_files[m_fileIndex++]);
+				}
+				value = std::move(m_values[m_valueIndex]);
+				name = m_stem;
+				if(m_values.size() > 1)
+					name += "-" + std::to_string(m_valueIndex);
+				++m_valueIndex;
+			}
+			if(!m_nameKey.empty())
+				applyNameKey(value, name);
+			return true;
+		}
+
+	private:
+		bool nextValue(json11::Json& value) {
+			for(; m_index % m_shardCount != m_shard; ++m_index) {
+				if(!m_reader->skip())
+					return false;
+			}
+			return m_reader->next(value);
+		}
+
+		void readFile(const boost::filesystem::path& p) {
+			std::ifstream ifs(p.string(), std::ios::binary);
+			if(!ifs)
+				throw std::invalid_argument("The file " + p.string() + " can not be opened.");
+			std::stringstream ss;
+			ss << ifs.rdbuf();
+			std::string err;
+			m_values = json11::Json::parse_multi(ss.str(), err);
+			if(!err.empty())
+				throw std::runtime_error("Invalid JSON in " + p.string() + " : " + err);
+			m_valueIndex = 0;
+			m_stem = p.stem().string();
+		}
+
+		/**
+		* Name the output after the member m_nameKey of value, when it is a string or a number.
+		*/
+		void applyNameKey(const json11::Json& value, std::string& name) const {
+			const json11::Json& key = value[m_nameKey];
+			std::string res;
+			if(key.is_string())
+				res = key.string_value();
+			else if(key.is_number())
+				res = std::to_string(static_cast<long long>(key.number_value()));
+			if(res.empty())
+				return;
+			//the name must not leave the output directory.
+			std::replace(res.begin(), res.end(), '/', '_');
+			std::replace(res.begin(), res.end(), '\\', '_');
+			if(res == "." || res == "..")
+				return;
+			name = res;
+		}
+
+		std::string m_nameKey;
+		std::size_t m_shard;
+		std::size_t m_shardCount;
+
+		std::ifstream m_file;
+		std::unique_ptr<JsonStreamReader> m_reader;
+		//index of the next value of the stream.
+		std::size_t m_index = 0;
+
+		std::vector<boost::filesystem::path> m_files;
+		std::size_t m_fileIndex = 0;
+		std::vector<json11::Json> m_values;
+		std::size_t m_valueIndex = 0;
+		std::string m_stem;
+	};
+
+	struct Statistics {
+		std::size_t count = 0;
+		std::size_t bytes = 0;
+		//rendering time of each context, in microseconds.
+		std::vector<double> latencies;
+
+		void add(double latency, std::size_t size) {
+			++count;
+			bytes += size;
+			latencies.push_back(latency);
+		}
+
+		void merge(const Statistics& other) {
+			count += other.count;
+			bytes += other.bytes;
+			latencies.insert(latencies.end(), other.latencies.begin(), other.latencies.end());
+		}
+
+		void write(std::ostream& os, double seconds) {
+			os << "rendered " << count << " contexts, " << bytes << " bytes in " << seconds << " s";
+			if(seconds > 0)
+				os << " : " << count / seconds << " contexts/s, " << bytes / seconds / (1024 * 1024) << " MB/s";
+			os << "\n";
+			if(latencies.empty())
+				return;
+			std::sort(latencies.begin(), latencies.end());
+			os << "latency (ms) : p50 " << percentile(0.5) << ", p90 " << percentile(0.9) << ", p99 " << percentile(0.99)
+					<< ", max " << latencies.back() / 1000 << "\n";
+		}
+
+	private:
+		double percentile(double q) const {
+			std::size_t index = std::min(latencies.size() - 1, static_cast<std::size_t>(q * latencies.size()));
+			return latencies[index] / 1000;
+		}
+	};
+
+	typedef std::chrono::steady_clock Clock;
+
+	double microseconds(Clock::time_point start, Clock::time_point end) {
+		return std::chrono::duration<double, std::micro>(end - start).count();
+	}
+
+	void writeFile(const Options& options, const std::string& name, const std::string& text) {
+		boost::filesystem::path p(options.outputDirectory);
+		p /= name + options.extension;
+		std::ofstream ofs(p.string(), std::ios::binary);
+		ofs.write(text.data(), static_cast<std::streamsize>(text.size()));
+		ofs.close();
+		if(!ofs)
+			throw std::runtime_error("The file " + p.string() + " can not be written.");
+	}
+
+	/**
+	* A worker rendering contexts with its own output buffer, and either its own renderer or the one of the
+	* fork server.
+	*/
+	class Worker {
+	public:
+		Worker(const CompiledTemplate& tmpl) : m_tmpl(tmpl), m_ownRenderer(new Renderer<JsonContextAdapter>()), m_renderer(*m_ownRenderer) {
+		}
+
+		Worker(const CompiledTemplate& tmpl, Renderer<JsonContextAdapter>& renderer) : m_tmpl(tmpl), m_renderer(renderer) {
+		}
+
+		/**
+		* Render value into output, and return the rendering time.
+		*/
+		double render(const json11::Json& value, std::string& output) {
+			m_os.str(std::string());
+			Clock::time_point start = Clock::now();
+			m_renderer.render(m_adapters.bind(value), m_os, m_tmpl);
+			Clock::time_point end = Clock::now();
+			output = m_os.str();
+			return microseconds(start, end);
+		}
+
+	private:
+		const CompiledTemplate& m_tmpl;
+		std::unique_ptr<Renderer<JsonContextAdapter>> m_ownRenderer;
+		Renderer<JsonContextAdapter>& m_renderer;
+		//the adapters of the previous contexts are reused.
+		JsonContextAdapterPool m_adapters;
+		std::ostringstream m_os;
+	};
+
+	/**
+	* Read the contexts by windows and render each window with the threads. The files are written by the threads,
+	* the standard output is written in the order of the contexts once the window is rendered.
+	*/
+	Statistics runThreads(const Options& options, const CompiledTemplate& tmpl) {
+		Source source(options);
+		std::vector<std::unique_ptr<Worker>> workers;
+		for(std::size_t i = 0; i < options.jobs; ++i)
+			workers.emplace_back(new Worker(tmpl));
+		std::unique_ptr<amanite::tools::ThreadPool> pool;
+		if(options.jobs > 1)
+			pool.reset(new amanite::tools::ThreadPool(options.jobs));
+
+		bool toFiles = !options.outputDirectory.empty();
+		std::vector<json11::Json> values(options.windowSize);
+		std::vector<std::string> names(options.windowSize);
+		std::vector<std::string> outputs(options.windowSize);
+		std::vector<double> latencies(options.windowSize);
+		std::vector<std::size_t> sizes(options.windowSize);
+		Statistics res;
+		for(;;) {
+			std::size_t size = 0;
+			while(size < options.windowSize && source.next(values[size], names[size]))
+				++size;
+			if(size == 0)
+				break;
+
+			std::atomic<std::size_t> next(0);
+			auto job = [&](std::size_t worker) {
+				for(std::size_t i = next++; i < size; i = next++) {
+					latencies[i] = workers[worker]->render(values[i], outputs[i]);
+					sizes[i] = outputs[i].size();
+					if(toFiles) {
+						writeFile(options, names[i], outputs[i]);
+						outputs[i].clear();
+					}
+				}
+			};
+			if(pool != nullptr)
+				pool->run(job);
+			else
+				job(0);
+
+			for(std::size_t i = 0; i < size; ++i) {
+				if(!toFiles)
+					std::cout.write(outputs[i].data(), static_cast<std::streamsize>(outputs[i].size()));
+				res.add(latencies[i], sizes[i]);
+			}
+			if(size < options.windowSize)
+				break;
+		}
+		std::cout.flush();
+		return res;
+	}
+
+	void writeAll(int fd, const void* data, std::size_t size) {
+		const char* p = static_cast<const char*>(data);
+		while(size > 0) {
+			ssize_t res = write(fd, p, size);
+			if(res < 0 && errno == EINTR)
+				continue;
+			if(res <= 0)
+				throw std::runtime_error(std::string("write failed : ") + std::strerror(errno));
+			p += res;
+			size -= static_cast<std::size_t>(res);
+		}
+	}
+
+	/**
+	* Read exactly size bytes, return false if the pipe is closed before.
+	*/
+	bool readAll(int fd, void* data, std::size_t size) {
+		char* p = static_cast<char*>(data);
+		while(size > 0) {
+			ssize_t res = read(fd, p, size);
+			if(res < 0 && errno == EINTR)
+				continue;
+			if(res <= 0)
+				return false;
+			p += res;
+			size -= static_cast<std::size_t>(res);
+		}
+		return true;
+	}
+
+	typedef ForkServer<JsonContextAdapter> Server;
+
+	/**
+	* Render one shard in a forked process with the renderer of the fork server, and send the statistics
+	* to the parent through fd.
+	*/
+	int runShard(const Options& options, Server& server, std::size_t shard, int fd) {
+		try {
+			Source source(options, shard, options.jobs);
+			Worker worker(server.get(options.root), server.getRenderer());
+			Statistics stats;
+			json11::Json value;
+			std::string name;
+			std::string output;
+			while(source.next(value, name)) {
+				double latency = worker.render(value, output);
+				writeFile(options, name, output);
+				stats.add(latency, output.size());
+			}
+			std::size_t header[2] = { stats.count, stats.bytes };
+			writeAll(fd, header, sizeof(header));
+			writeAll(fd, stats.latencies.data(), stats.latencies.size() * sizeof(double));
+			return 0;
+		} catch(const std::exception& e) {
+			std::cerr << "shard " << shard << " : " << e.what() << std::endl;
+			return 1;
+		}
+	}
+
+	/**
+	* Fork one process per shard from the warmed up fork server, so that they share the compiled templates and
+	* the script engine, and gather their statistics.
+	*/
+	Statistics runProcesses(const Options& options, Server& server) {
+		std::vector<pid_t> children;
+		std::vector<int> pipes;
+		for(std::size_t shard = 0; shard < options.jobs; ++shard) {
+			int fds[2];
+			if(pipe(fds) != 0)
+				throw std::runtime_error(std::string("pipe failed : ") + std::strerror(errno));
+			pid_t pid = server.spawn([&](Server& child, std::size_t shard) {
+				close(fds[0]);
+				for(int fd : pipes)
+					close(fd);
+				int status = runShard(options, child, shard, fds[1]);
+				close(fds[1]);
+				return status;
+			}, shard);
+			close(fds[1]);
+			children.push_back(pid);
+			pipes.push_back(fds[0]);
+		}
+
+		Statistics res;
+		bool failed = false;
+		for(std::size_t shard = 0; shard < children.size(); ++shard) {
+			Statistics stats;
+			std::size_t header[2];
+			if(readAll(pipes[shard], header, sizeof(header))) {
+				stats.count = header[0];
+				stats.bytes = header[1];
+				stats.latencies.resize(stats.count);
+				if(!readAll(pipes[shard], stats.latencies.data(), stats.count * sizeof(double)))
+					stats.latencies.clear();
+			}
+			close(pipes[shard]);
+
+			int status;
+			while(waitpid(children[shard], &status, 0) < 0 && errno == EINTR) {
+			}
+			if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+				failed = true;
+			res.merge(stats);
+		}
+		if(failed)
+			throw std::runtime_error("Some shards failed, their outputs are incomplete");
+		return res;
+	}
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	try {
+		options = parseOptions(argc, argv);
+	} catch(const std::exception& e) {
+		std::cerr << e.what() << "\n" << usage;
+		return 2;
+	}
+
+	try {
+		std::ios::sync_with_stdio(false);
+		Clock::time_point start = Clock::now();
+
+		Compiler compiler;
+		compiler.getConfiguration().templatePath = options.templatePath;
+		compiler.getConfiguration().minifyHtml = options.minify;
+		Server server(compiler);
+		const CompiledTemplate& tmpl = server.add(options.root);
+		if(options.processes)
+			server.warmUp();
+		Clock::time_point compiled = Clock::now();
+
+		if(!options.outputDirectory.empty())
+			boost::filesystem::create_directories(options.outputDirectory);
+		Statistics stats = options.processes ? runProcesses(options, server) : runThreads(options, tmpl);
+		Clock::time_point end = Clock::now();
+
+		if(!options.quiet) {
+			std::cerr << "compiled " << options.root << " in " << microseconds(start, compiled) / 1000 << " ms\n";
+			stats.write(std::cerr, microseconds(compiled, end) / 1000000);
+		}
+	} catch(const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,738 @@
+/**
+* amanite-renderd : render server keeping the compiled templates in memory, listening on a Unix domain socket.
+*
+* Every message is a frame : its size as a big endian u32, then a kind byte and a payload of size - 1 bytes.
+*
+*   request  := 'J' nameLength:u16 name json      render the template name with a JSON context
+*             | 'B' nameLength:u16 name document  render it with a binary context (see BinaryDocument)
+*             | 'M'                               ask for the metrics
+*   response := ('D' data)* ('O' | 'E' message)
+*
+* The output is streamed back in 'D' frames while it is rendered, and ends with 'O'. A response ending with 'E'
+* failed, the data sent before the error must be discarded. A connection may send any number of requests,
+* each one answered before the next one is read. With --timeout, a longer render is stopped and answered with an
+* 'E' message telling where it stopped.
+*
+* Connections with a pending request are queued, and served by a fixed set of worker threads. Templates are
+* compiled the first time they are requested, or at start with --preload. A connection blocking a worker on a
+* read or a write for longer than --io-timeout is closed.
+*/
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+
+#include "amanite/template_engine/Compiler.h"
+#include "amanite/template_engine/Linker.h"
+#include "amanite/template_engine/Renderer.h"
+#include "amanite/contexts/json/JsonContextAdapter.h"
+#include "amanite/contexts/binary/BinaryContextAdapter.h"
+#include "amanite/tools/ThreadPool.h"
+
+using namespace amanite::template_engine;
+using amanite::template_engine::context::JsonContextAdapter;
+using amanite::template_engine::context::JsonContextAdapterPool;
+using amanite::template_engine::context::BinaryContextAdapter;
+using amanite::template_engine::context::BinaryDocument;
+
+namespace {
+
+	const char* usage =
+		"usage : amanite-renderd [options]\n"
+		"  -s, --socket PATH     path of the socket (default : amanite-renderd.sock)\n"
+		"  -t, --templates DIR   directory of the templates (default : current directory)\n"
+		"  -r, --preload NAME    compile the template NAME at start, may be repeated\n"
+		"  -j, --jobs N          number of worker threads (default : number of cores)\n"
+		"  -l, --max-request N   maximal size of a request in bytes (default : 64MB)\n"
+		"  -T, --timeout MS      stop the renders taking longer than MS milliseconds (default : no limit)\n"
+		"  -i, --io-timeout MS   drop the clients blocking a read or a write for MS milliseconds (default : 10000)\n"
+		"  -m, --minify          minify the HTML of the templates\n"
+		"  -h, --help            show this help\n";
+
+	struct Options {
+		Options() :
+				socketPath("amanite-renderd.sock"),
+				jobs(std::max(std::thread::hardware_concurrency(), 1u)),
+				maxRequestSize(64 * 1024 * 1024),
+				timeout(0),
+				ioTimeout(10000),
+				minify(false) {
+
+		}
+
+		std::string socketPath;
+		std::string templatePath;
+		std::vector<std::string> preload;
+		std::size_t jobs;
+		std::size_t maxRequestSize;
+		//in milliseconds, 0 for no limit.
+		std::size_t timeout;
+		//in milliseconds, so that a stalled client does not hold a worker.
+		std::size_t ioTimeout;
+		bool minify;
+	};
+
+	std::size_t toCount(const std::string& option, const std::string& value) {
+		char* end = nullptr;
+		unsigned long res = std::strtoul(value.c_str(), &end, 10);
+		if(value.empty() || *end != '\0' || res == 0)
+			throw std::invalid_argument("The option " + option + " expects a positive number");
+		return static_cast<std::size_t>(res);
+	}
+
+	Options parseOptions(int argc, char** argv) {
+		Options res;
+		for(int i = 1; i < argc; ++i) {
+			std::string option = argv[i];
+			auto value = [&]() -> std::string {
+				if(i + 1 >= argc)
+					throw std::invalid_argument("The option " + option + " expects a value");
+				return argv[++i];
+			};
+			if(option == "-s" || option == "--socket") {
+				res.socketPath = value();
+			} else if(option == "-t" || option == "--templates") {
+				res.templatePath = value();
+			} else if(option == "-r" || option == "--preload") {
+				res.preload.push_back(value());
+			} else if(option == "-j" || option == "--jobs") {
+				res.jobs = toCount(option, value());
+			} else if(option == "-l" || option == "--max-request") {
+				res.maxRequestSize = toCount(option, value());
+			} else if(option == "-T" || option == "--timeout") {
+				res.timeout = toCount(option, value());
+			} else if(option == "-i" || option == "--io-timeout") {
+				res.ioTimeout = toCount(option, value());
+			} else if(option == "-m" || option == "--minify") {
+				res.minify = true;
+			} else if(option == "-h" || option == "--help") {
+				std::cout << usage;
+				std::exit(0);
+			} else {
+				throw std::invalid_argument("Unknown option " + option);
+			}
+		}
+		return res;
+	}
+
+	typedef std::chrono::steady_clock Clock;
+
+	double microseconds(Clock::time_point start, Clock::time_point end) {
+		return std::chrono::duration<double, std::micro>(end - start).count();
+	}
+
+	void fail(const char* call) {
+		throw std::runtime_error(std::string(call) + " failed : " + std::strerror(errno));
+	}
+
+	/**
+	* Compiled and linked templates, by name. The compiler keeps the partials, so they are compiled only once too.
+	* Only the templates under the templates directory are served : absolute names, and names containing "..",
+	* are rejected.
+	*/
+	class Templates {
+	public:
+		Templates(const Options& options) {
+			m_compiler.getConfiguration().templatePath = options.templatePath;
+			m_compiler.getConfiguration().minifyHtml = options.minify;
+		}
+
+		std::shared_ptr<const CompiledTemplate> get(const std::string& name) {
+			boost::filesystem::path path(name);
+			if(name.empty() || path.has_root_path() || std::find(path.begin(), path.end(), "..") != path.end())
+				throw std::invalid_argument("Invalid template name \"" + name + "\"");
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto it = m_templates.find(name);
+			if(it != m_templates.end())
+				return it->second;
+			std::shared_ptr<CompiledTemplate> res(new CompiledTemplate(m_compiler.compile(name)));
+			Linker().link(*res);
+			m_templates[name] = res;
+			return res;
+		}
+
+		std::size_t size() {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_templates.size();
+		}
+
+	private:
+		std::mutex m_mutex;
+		Compiler m_compiler;
+		std::map<std::string, std::shared_ptr<const CompiledTemplate>> m_templates;
+	};
+
+	/**
+	* Counters, queue depth, and the latencies of the last requests.
+	*/
+	class Metrics {
+	public:
+		static const std::size_t historySize = 4096;
+
+		Metrics() : m_start(Clock::now()), m_waits(historySize), m_latencies(historySize) {
+		}
+
+		void queued() {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			++m_queueDepth;
+			m_maxQueueDepth = std::max(m_maxQueueDepth, m_queueDepth);
+		}
+
+		void dequeued(double wait) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			--m_queueDepth;
+			m_waits[m_waitCount++ % historySize] = wait;
+		}
+
+		void rendered(double latency, std::size_t bytes, bool error) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if(error)
+				++m_errors;
+			m_bytes += bytes;
+			m_latencies[m_requests++ % historySize] = latency;
+		}
+
+		void timedOut() {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			++m_timeouts;
+		}
+
+		void connected(int delta) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_connections += delta;
+		}
+
+		/**
+		* The adapter pool of a worker went from previousBytes to bytes.
+		*/
+		void pooled(std::size_t previousBytes, std::size_t bytes) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_adapterBytes += bytes;
+			m_adapterBytes -= previousBytes;
+		}
+
+		std::string report(std::size_t templateCount) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			std::ostringstream os;
+			os << "uptime_seconds " << microseconds(m_start, Clock::now()) / 1000000 << "\n"
+					<< "connections " << m_connections << "\n"
+					<< "templates " << templateCount << "\n"
+					<< "requests " << m_requests << "\n"
+					<< "errors " << m_errors << "\n"
+					<< "timeouts " << m_timeouts << "\n"
+					<< "bytes " << m_bytes << "\n"
+					<< "queue_depth " << m_queueDepth << "\n"
+					<< "queue_depth_max " << m_maxQueueDepth << "\n"
+					<< "adapter_pool_bytes " << m_adapterBytes << "\n";
+			writePercentiles(os, "queue_wait_ms", m_waits, m_waitCount);
+			writePercentiles(os, "latency_ms", m_latencies, m_requests);
+			return os.str();
+		}
+
+	private:
+		static void writePercentiles(std::ostream& os, const char* name, const std::vector<double>& history, std::size_t count) {
+			std::vector<double> values(history.begin(), history.begin() + (count < historySize ? count : historySize));
+			if(values.empty())
+				return;
+			std::sort(values.begin(), values.end());
+			const double quantiles[] = { 0.5, 0.9, 0.99 };
+			const char* labels[] = { "p50", "p90", "p99" };
+			for(std::size_t i = 0; i < 3; ++i) {
+				std::size_t index = std::min(values.size() - 1, static_cast<std::size_t>(quantiles[i] * values.size()));
+				os << name << "_" << labels[i] << " " << values[index] / 1000 << "\n";
+			}
+			os << name << "_max " << values.back() / 1000 << "\n";
+		}
+
+		std::mutex m_mutex;
+		Clock::time_point m_start;
+		std::size_t m_connections = 0;
+		std::size_t m_requests = 0;
+		std::size_t m_errors = 0;
+		std::size_t m_timeouts = 0;
+		std::size_t m_bytes = 0;
+		std::size_t m_queueDepth = 0;
+		std::size_t m_maxQueueDepth = 0;
+		std::size_t m_adapterBytes = 0;
+		std::vector<double> m_waits;
+		std::size_t m_waitCount = 0;
+		std::vector<double> m_latencies;
+	};
+
+	void writeAll(int fd, const char* data, std::size_t size) {
+		while(size > 0) {
+			ssize_t res = send(fd, data, size, MSG_NOSIGNAL);
+			if(res < 0 && errno == EINTR)
+				continue;
+			if(res <= 0)
+				fail("send");
+			data += res;
+			size -= static_cast<std::size_t>(res);
+		}
+	}
+
+	/**
+	* Read exactly size bytes. Return false if the connection is closed before the first one.
+	*/
+	bool readAll(int fd, char* data, std::size_t size) {
+		std::size_t done = 0;
+		while(done < size) {
+			ssize_t res = recv(fd, data + done, size - done, 0);
+			if(res < 0 && errno == EINTR)
+				continue;
+			if(res < 0)
+				fail("recv");
+			if(res == 0) {
+				if(done == 0)
+					return false;
+				throw std::runtime_error("Truncated request");
+			}
+			done += static_cast<std::size_t>(res);
+		}
+		return true;
+	}
+
+	void writeHeader(char* header, std::size_t size, char kind) {
+		std::uint32_t frameSize = static_cast<std::uint32_t>(size + 1);
+		header[0] = static_cast<char>(frameSize >> 24);
+		header[1] = static_cast<char>(frameSize >> 16);
+		header[2] = static_cast<char>(frameSize >> 8);
+		header[3] = static_cast<char>(frameSize);
+		header[4] = kind;
+	}
+
+	void writeFrame(int fd, char kind, const std::string& payload) {
+		char header[5];
+		writeHeader(header, payload.size(), kind);
+		writeAll(fd, header, sizeof(header));
+		writeAll(fd, payload.data(), payload.size());
+	}
+
+	/**
+	* Stream buffer sending what is written to it in 'D' frames, the header being written in front of the data.
+	*/
+	class FrameStreamBuf : public std::streambuf {
+	public:
+		static const std::size_t headerSize = 5;
+
+		FrameStreamBuf(std::size_t bufferSize = 64 * 1024) : m_buffer(headerSize + bufferSize) {
+		}
+
+		/**
+		* Send the frames to fd, dropping what has not been sent yet.
+		*/
+		void reset(int fd) {
+			m_fd = fd;
+			m_sent = 0;
+			setp(m_buffer.data() + headerSize, m_buffer.data() + m_buffer.size());
+		}
+
+		/**
+		* Number of bytes written so far.
+		*/
+		std::size_t size() const {
+			return m_sent + static_cast<std::size_t>(pptr() - pbase());
+		}
+
+	protected:
+		int overflow(int c) override {
+			send();
+			if(c != traits_type::eof()) {
+				*pptr() = static_cast<char>(c);
+				pbump(1);
+			}
+			return traits_type::not_eof(c);
+		}
+
+		int sync() override {
+			send();
+			return 0;
+		}
+
+	private:
+		void send() {
+			std::size_t size = static_cast<std::size_t>(pptr() - pbase());
+			if(size == 0)
+				return;
+			writeHeader(m_buffer.data(), size, 'D');
+			writeAll(m_fd, m_buffer.data(), headerSize + size);
+			m_sent += size;
+			setp(m_buffer.data() + headerSize, m_buffer.data() + m_buffer.size());
+		}
+
+		std::vector<char> m_buffer;
+		int m_fd = -1;
+		std::size_t m_sent = 0;
+	};
+
+	/**
+	* Renderers and buffers of a worker thread.
+	*/
+	class Worker {
+	public:
+		Worker(std::size_t timeout) : m_os(&m_frames), m_timeout(timeout) {
+			if(m_timeout > 0) {
+				m_jsonRenderer.setCancellation(&m_cancellation);
+				m_binaryRenderer.setCancellation(&m_cancellation);
+			}
+		}
+
+		/**
+		* Read one request from fd and answer it. Return false if the connection is closed.
+		*/
+		bool serve(int fd, Templates& templates, Metrics& metrics, std::size_t maxRequestSize) {
+			char header[4];
+			if(!readAll(fd, header, sizeof(header)))
+				return false;
+			std::size_t size = static_cast<std::size_t>(static_cast<unsigned char>(header[0])) << 24
+					| static_cast<std::size_t>(static_cast<unsigned char>(header[1])) << 16
+					| static_cast<std::size_t>(static_cast<unsigned char>(header[2])) << 8
+					| static_cast<std::size_t>(static_cast<unsigned char>(header[3]));
+			if(size == 0 || size > maxRequestSize) {
+				//the rest of the stream can not be read.
+				writeFrame(fd, 'E', "Invalid request size " + std::to_string(size));
+				return false;
+			}
+			m_request.resize(size);
+			readAll(fd, &m_request[0], size);
+
+			Clock::time_point start = Clock::now();
+			char kind = m_request[0];
+			if(kind == 'M') {
+				writeFrame(fd, 'D', metrics.report(templates.size()));
+				writeFrame(fd, 'O', std::string());
+				return true;
+			}
+
+			m_frames.reset(fd);
+			m_os.clear();
+			if(m_timeout > 0)
+				m_cancellation.setTimeout(std::chrono::milliseconds(m_timeout));
+			try {
+				render(kind, templates);
+				m_os.flush();
+				reportPool(metrics);
+			} catch(const std::exception& e) {
+				reportPool(metrics);
+				//a failed write to the client ends the connection.
+				if(!m_os)
+					throw std::runtime_error("The output could not be sent");
+				metrics.rendered(microseconds(start, Clock::now()), m_frames.size(), true);
+				std::string message = e.what();
+				const RenderCancelled* cancelled = dynamic_cast<const RenderCancelled*>(&e);
+				if(cancelled != nullptr) {
+					metrics.timedOut();
+					message += " at " + cancelled->getLocation();
+				}
+				m_frames.reset(fd);
+				writeFrame(fd, 'E', message);
+				return true;
+			}
+			if(!m_os)
+				throw std::runtime_error("The output could not be sent");
+			writeFrame(fd, 'O', std::string());
+			metrics.rendered(microseconds(start, Clock::now()), m_frames.size(), false);
+			return true;
+		}
+
+	private:
+		void render(char kind, Templates& templates) {
+			if(m_request.size() < 3)
+				throw std::invalid_argument("Truncated request");
+			std::size_t nameSize = static_cast<std::size_t>(static_cast<unsigned char>(m_request[1])) << 8
+					| static_cast<std::size_t>(static_cast<unsigned char>(m_request[2]));
+			if(3 + nameSize > m_request.size())
+				throw std::invalid_argument("Truncated request");
+			std::string name = m_request.substr(3, nameSize);
+			const char* context = m_request.data() + 3 + nameSize;
+			std::size_t contextSize = m_request.size() - 3 - nameSize;
+
+			if(kind == 'J') {
+				std::shared_ptr<const CompiledTemplate> tmpl = templates.get(name);
+				std::string err;
+				json11::Json json = json11::Json::parse(std::string(context, contextSize), err);
+				if(!err.empty())
+					throw std::invalid_argument("Invalid JSON context : " + err);
+				m_jsonRenderer.render(m_jsonAdapters.bind(json), m_os, *tmpl);
+			} else if(kind == 'B') {
+				std::shared_ptr<const CompiledTemplate> tmpl = templates.get(name);
+				//the document reads the request in place.
+				std::shared_ptr<BinaryDocument> document = BinaryDocument::fromBuffer(context, contextSize);
+				BinaryContextAdapter c(*document);
+				m_binaryRenderer.render(c, m_os, *tmpl);
+			} else {
+				throw std::invalid_argument("Unknown request kind " + std::to_string(static_cast<int>(kind)));
+			}
+		}
+
+		void reportPool(Metrics& metrics) {
+			std::size_t bytes = m_jsonAdapters.getStatistics().bytes;
+			metrics.pooled(m_adapterBytes, bytes);
+			m_adapterBytes = bytes;
+		}
+
+		std::string m_request;
+		FrameStreamBuf m_frames;
+		std::ostream m_os;
+		Renderer<JsonContextAdapter> m_jsonRenderer;
+		Renderer<BinaryContextAdapter> m_binaryRenderer;
+		//the adapters of the previous JSON contexts are reused, m_adapterBytes is their size last reported.
+		JsonContextAdapterPool m_jsonAdapters;
+		std::size_t m_adapterBytes = 0;
+		//deadline of the request being rendered, if the renders are limited to m_timeout milliseconds.
+		std::size_t m_timeout;
+		Cancellation m_cancellation;
+	};
+
+	//written to by the signal handler to stop the server.
+	int wakeUpFd = -1;
+
+	void onSignal(int) {
+		char c = 's';
+		ssize_t res = write(wakeUpFd, &c, 1);
+		(void)res;
+	}
+
+	/**
+	* The main thread polls the listening socket and the idle connections. A connection with a request to read
+	* is queued for the workers, which give it back to the main thread once the request is answered.
+	*/
+	class Server {
+	public:
+		Server(const Options& options) : m_options(options), m_templates(options) {
+			for(const std::string& name : options.preload)
+				m_templates.get(name);
+			for(std::size_t i = 0; i < options.jobs; ++i)
+				m_workers.emplace_back(new Worker(m_options.timeout));
+		}
+
+		void run() {
+			int fds[2];
+			if(pipe(fds) != 0)
+				fail("pipe");
+			m_wakeUp[0] = fds[0];
+			m_wakeUp[1] = fds[1];
+			fcntl(m_wakeUp[0], F_SETFL, O_NONBLOCK);
+			fcntl(m_wakeUp[1], F_SETFL, O_NONBLOCK);
+			wakeUpFd = m_wakeUp[1];
+			std::signal(SIGINT, &onSignal);
+			std::signal(SIGTERM, &onSignal);
+			std::signal(SIGPIPE, SIG_IGN);
+
+			listen();
+			amanite::tools::ThreadPool pool(m_workers.size());
+			std::thread workers([&]() {
+				pool.run([this](std::size_t worker) { work(worker); });
+			});
+			try {
+				poll();
+			} catch(...) {
+				stop();
+				workers.join();
+				throw;
+			}
+			stop();
+			workers.join();
+
+			for(int fd : m_idle)
+				close(fd);
+			close(m_listen);
+			unlink(m_options.socketPath.c_str());
+		}
+
+	private:
+		struct Pending {
+			int fd;
+			Clock::time_point since;
+		};
+
+		void listen() {
+			sockaddr_un address;
+			std::memset(&address, 0, sizeof(address));
+			address.sun_family = AF_UNIX;
+			if(m_options.socketPath.size() >= sizeof(address.sun_path))
+				throw std::invalid_argument("The socket path is too long");
+			std::strcpy(address.sun_path, m_options.socketPath.c_str());
+			unlink(m_options.socketPath.c_str());
+
+			m_listen = socket(AF_UNIX, SOCK_STREAM, 0);
+			if(m_listen < 0)
+				fail("socket");
+			if(bind(m_listen, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+				fail("bind");
+			if(::listen(m_listen, 128) != 0)
+				fail("listen");
+			fcntl(m_listen, F_SETFL, O_NONBLOCK);
+		}
+
+		void poll() {
+			std::vector<pollfd> fds;
+			for(;;) {
+				fds.clear();
+				fds.push_back({ m_listen, POLLIN, 0 });
+				fds.push_back({ m_wakeUp[0], POLLIN, 0 });
+				for(int fd : m_idle)
+					fds.push_back({ fd, POLLIN, 0 });
+				if(::poll(fds.data(), fds.size(), -1) < 0) {
+					if(errno == EINTR)
+						continue;
+					fail("poll");
+				}
+
+				if(fds[1].revents != 0) {
+					char buffer[64];
+					bool stopping = false;
+					for(ssize_t res; (res = read(m_wakeUp[0], buffer, sizeof(buffer))) > 0;)
+						stopping = stopping || std::find(buffer, buffer + res, 's') != buffer + res;
+					if(stopping)
+						return;
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_idle.insert(m_idle.end(), m_returned.begin(), m_returned.end());
+					m_returned.clear();
+				}
+
+				std::vector<int> ready;
+				for(std::size_t i = 2; i < fds.size(); ++i) {
+					if(fds[i].revents != 0)
+						ready.push_back(fds[i].fd);
+				}
+				if(!ready.empty()) {
+					std::lock_guard<std::mutex> lock(m_mutex);
+					Clock::time_point now = Clock::now();
+					for(int fd : ready) {
+						m_idle.erase(std::find(m_idle.begin(), m_idle.end(), fd));
+						m_queue.push_back({ fd, now });
+						m_metrics.queued();
+					}
+					m_wakeUpWorker.notify_all();
+				}
+
+				if(fds[0].revents != 0) {
+					for(int fd; (fd = accept(m_listen, nullptr, nullptr)) >= 0;) {
+						setTimeouts(fd);
+						m_idle.push_back(fd);
+						m_metrics.connected(1);
+					}
+				}
+			}
+		}
+
+		/**
+		* The workers read the requests and write the output with blocking calls, which fail once the client
+		* blocks them for the I/O timeout, so that the connection is closed.
+		*/
+		void setTimeouts(int fd) {
+			timeval timeout;
+			timeout.tv_sec = static_cast<time_t>(m_options.ioTimeout / 1000);
+			timeout.tv_usec = static_cast<suseconds_t>(m_options.ioTimeout % 1000 * 1000);
+			if(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0
+					|| setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) != 0)
+				fail("setsockopt");
+		}
+
+		void stop() {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+			m_wakeUpWorker.notify_all();
+		}
+
+		void work(std::size_t worker) {
+			for(;;) {
+				Pending pending;
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_wakeUpWorker.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+					if(m_stopping) {
+						for(const Pending& p : m_queue)
+							close(p.fd);
+						m_queue.clear();
+						return;
+					}
+					pending = m_queue.front();
+					m_queue.pop_front();
+				}
+				m_metrics.dequeued(microseconds(pending.since, Clock::now()));
+
+				bool open = false;
+				try {
+					open = m_workers[worker]->serve(pending.fd, m_templates, m_metrics, m_options.maxRequestSize);
+				} catch(const std::exception&) {
+					//the client is gone, or sent an incomplete request.
+				}
+				if(!open) {
+					close(pending.fd);
+					m_metrics.connected(-1);
+					continue;
+				}
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if(m_stopping) {
+					close(pending.fd);
+					continue;
+				}
+				m_returned.push_back(pending.fd);
+				char c = 'r';
+				ssize_t res = write(m_wakeUp[1], &c, 1);
+				(void)res;
+			}
+		}
+
+		const Options& m_options;
+		Templates m_templates;
+		Metrics m_metrics;
+		std::vector<std::unique_ptr<Worker>> m_workers;
+
+		int m_listen = -1;
+		int m_wakeUp[2] = { -1, -1 };
+		//connections waiting for a request, polled by the main thread.
+		std::vector<int> m_idle;
+
+		std::mutex m_mutex;
+		std::condition_variable m_wakeUpWorker;
+		std::deque<Pending> m_queue;
+		//connections given back by the workers.
+		std::vector<int> m_returned;
+		bool m_stopping = false;
+	};
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	try {
+		options = parseOptions(argc, argv);
+	} catch(const std::exception& e) {
+		std::cerr << e.what() << "\n" << usage;
+		return 2;
+	}
+
+	try {
+		Server server(options);
+		server.run();
+	} catch(const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}